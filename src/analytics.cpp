@@ -0,0 +1,96 @@
+// Copyright (c) 2025-2026 Ewan Crawford
+
+#include "common.hpp"
+#include <format>
+#include <numbers>
+#include <stdexcept>
+
+void vkParticle::createAnalytics() {
+  if (MOptions.analyticsFile.empty()) {
+    return;
+  }
+
+  MAnalyticsFile.open(MOptions.analyticsFile);
+  if (!MAnalyticsFile) {
+    throw std::runtime_error(std::format("failed to open analytics file '{}'",
+                                         MOptions.analyticsFile));
+  }
+  MAnalyticsFile << "time_s,particles,histogram,bin_start,bin_end,value\n";
+
+  // Only the bins are read back, by the simulation thread once the step
+  // measuring them has completed.
+  constexpr vk::DeviceSize AnalyticsBufferSize =
+      sizeof(uint32_t) * SAnalyticsBins * 2;
+  createBuffer(MDevice, MPhysicalDevice, AnalyticsBufferSize,
+               vk::BufferUsageFlagBits::eStorageBuffer |
+                   vk::BufferUsageFlagBits::eTransferDst,
+               vk::MemoryPropertyFlagBits::eHostVisible |
+                   vk::MemoryPropertyFlagBits::eHostCoherent,
+               MAnalyticsBuffer, MAnalyticsBufferMemory);
+  MAnalyticsMapped = static_cast<uint32_t *>(
+      MAnalyticsBufferMemory.mapMemory(0, AnalyticsBufferSize));
+}
+
+void vkParticle::recordAnalyticsCommands(
+    vk::raii::CommandBuffer &commandBuffer, uint32_t inState,
+    uint32_t outState, uint32_t particleCount) {
+  // The step may still be reading the grid, or the bins from the last
+  // measurement, before they are overwritten.
+  memoryBarrier(commandBuffer, vk::PipelineStageFlagBits2::eComputeShader,
+                vk::AccessFlagBits2::eShaderStorageRead |
+                    vk::AccessFlagBits2::eShaderStorageWrite,
+                vk::PipelineStageFlagBits2::eComputeShader |
+                    vk::PipelineStageFlagBits2::eTransfer,
+                vk::AccessFlagBits2::eShaderStorageWrite |
+                    vk::AccessFlagBits2::eTransferWrite);
+  commandBuffer.fillBuffer(MAnalyticsBuffer, 0, vk::WholeSize, 0);
+
+  // Grid of the state being read, which the input state is measured from
+  // as the output state may still be being written by the step.
+  recordGridRebuildCommands(commandBuffer, inState, outState, particleCount);
+
+  uint32_t workGroups =
+      (particleCount + SComputeWorkItems - 1) / SComputeWorkItems;
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             MSpeedHistogramPipeline);
+  commandBuffer.dispatch(workGroups, 1, 1);
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             MPairHistogramPipeline);
+  commandBuffer.dispatch(workGroups, 1, 1);
+
+  // Make the bins visible to the host once the step has completed
+  memoryBarrier(commandBuffer, vk::PipelineStageFlagBits2::eComputeShader,
+                vk::AccessFlagBits2::eShaderStorageWrite,
+                vk::PipelineStageFlagBits2::eHost,
+                vk::AccessFlagBits2::eHostRead);
+}
+
+void vkParticle::writeAnalytics(double time, uint32_t particleCount) {
+  constexpr float SpeedBinWidth = SAnalyticsMaxSpeed / SAnalyticsBins;
+  for (uint32_t bin = 0; bin < SAnalyticsBins; bin++) {
+    MAnalyticsFile << std::format("{:.3f},{},speed,{:.6g},{:.6g},{}\n", time,
+                                  particleCount, bin * SpeedBinWidth,
+                                  (bin + 1) * SpeedBinWidth,
+                                  MAnalyticsMapped[bin]);
+  }
+
+  // Pairs are counted from both particles, so dividing by the particle count
+  // gives the average neighbours in each shell. g(r) normalises that by the
+  // neighbours of an ideal gas at the same density over the 2x2 clip space
+  // window, ignoring the shells cut short by its border.
+  constexpr double RadiusBinWidth =
+      static_cast<double>(SAnalyticsMaxRadius) / SAnalyticsBins;
+  const double density = particleCount / 4.0;
+  const uint32_t *pairBins = MAnalyticsMapped + SAnalyticsBins;
+  for (uint32_t bin = 0; bin < SAnalyticsBins; bin++) {
+    double inner = bin * RadiusBinWidth;
+    double outer = (bin + 1) * RadiusBinWidth;
+    double shellArea = std::numbers::pi * (outer * outer - inner * inner);
+    double rdf = particleCount == 0
+                     ? 0.0
+                     : pairBins[bin] / (particleCount * density * shellArea);
+    MAnalyticsFile << std::format("{:.3f},{},rdf,{:.6g},{:.6g},{:.6g}\n",
+                                  time, particleCount, inner, outer, rdf);
+  }
+  MAnalyticsFile.flush();
+}
@@ -0,0 +1,103 @@
+// Copyright (c) 2025-2026 Ewan Crawford
+
+#include "common.hpp"
+#include <algorithm>
+#include <cmath>
+
+ParticleBudget::ParticleBudget(uint32_t minCount, uint32_t maxCount,
+                               uint32_t granularity, double targetFrameTime)
+    : MMinCount(minCount), MMaxCount(maxCount), MGranularity(granularity),
+      MTargetFrameTime(targetFrameTime), MCount(minCount) {}
+
+uint32_t ParticleBudget::update(double computeTime, double renderTime) {
+  // Smooth over noisy individual timings with an exponential moving average,
+  // as each step only changes the count by a small amount anyway.
+  constexpr double Smoothing = 0.1;
+  double frameTime = computeTime + renderTime;
+  MFrameTime = MFrameTime == 0.0
+                   ? frameTime
+                   : MFrameTime + Smoothing * (frameTime - MFrameTime);
+  if (MFrameTime <= 0.0) {
+    return MCount;
+  }
+
+  // Cost of both the simulation step and the draw is roughly linear in the
+  // number of particles, so scale the count by the ratio of the target to the
+  // measured time. Ignore small errors to avoid jitter, and limit the rate of
+  // change as timings lag behind count changes by a few steps.
+  double scale = MTargetFrameTime / MFrameTime;
+  if (std::abs(scale - 1.0) < 0.05) {
+    return MCount;
+  }
+  scale = std::clamp(scale, 0.95, 1.05);
+
+  double count = std::round(MCount * scale / MGranularity) * MGranularity;
+  MCount = static_cast<uint32_t>(
+      std::clamp(count, double(MMinCount), double(MMaxCount)));
+  return MCount;
+}
+
+void vkParticle::createQueryPools() {
+  // Timestamps are only supported if the queue writes some valid bits
+  uint32_t validBits =
+      MPhysicalDevice.getQueueFamilyProperties()[MQueueIndex]
+          .timestampValidBits;
+  if (validBits == 0) {
+    MTimestampPeriod = 0.0f;
+    return;
+  }
+  MTimestampPeriod = MPhysicalDevice.getProperties().limits.timestampPeriod;
+  MTimestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+  // A begin and end timestamp for each command-buffer that is timed.
+  vk::QueryPoolCreateInfo computeInfo{.queryType = vk::QueryType::eTimestamp,
+                                      .queryCount = SSimulationStateCount * 2};
+  MComputeQueryPool = vk::raii::QueryPool(MDevice, computeInfo);
+  vk::QueryPoolCreateInfo graphicsInfo{.queryType = vk::QueryType::eTimestamp,
+                                       .queryCount = SMaxFramesInFlight * 2};
+  MGraphicsQueryPool = vk::raii::QueryPool(MDevice, graphicsInfo);
+  // Grid builds are also timed within the step, to compare ways of building
+  if (MOptions.kernel == ComputeKernel::Collide) {
+    MGridQueryPool = vk::raii::QueryPool(MDevice, computeInfo);
+  }
+  // As are the stages of a plasma or fluid step, to see which dominates
+  if (usesStageTimes()) {
+    vk::QueryPoolCreateInfo stageInfo{
+        .queryType = vk::QueryType::eTimestamp,
+        .queryCount = SSimulationStateCount *
+                      static_cast<uint32_t>(MStageTimes.size() + 1)};
+    MStageQueryPool = vk::raii::QueryPool(MDevice, stageInfo);
+  }
+}
+
+double vkParticle::readTimestampQueries(vk::raii::QueryPool &queryPool,
+                                        uint32_t firstQuery) {
+  // Work has already completed on the host, so waiting won't block.
+  auto [result, timestamps] = queryPool.getResults<uint64_t>(
+      firstQuery, 2, 2 * sizeof(uint64_t), sizeof(uint64_t),
+      vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait);
+  if (result != vk::Result::eSuccess) {
+    return 0.0;
+  }
+  uint64_t ticks = (timestamps[1] - timestamps[0]) & MTimestampMask;
+  // Timestamp period is in nanoseconds per tick
+  return static_cast<double>(ticks) * MTimestampPeriod / 1000000.0;
+}
+
+void vkParticle::writeStageTimestamp(vk::raii::CommandBuffer &commandBuffer,
+                                     uint32_t outState, uint32_t stage) {
+  if (MTimestampPeriod == 0.0f) {
+    return;
+  }
+  // A timestamp before the first stage and after each stage
+  const uint32_t queryCount = static_cast<uint32_t>(MStageTimes.size() + 1);
+  const uint32_t firstQuery = outState * queryCount;
+  if (stage == 0) {
+    commandBuffer.resetQueryPool(MStageQueryPool, firstQuery, queryCount);
+    commandBuffer.writeTimestamp2(vk::PipelineStageFlagBits2::eTopOfPipe,
+                                  MStageQueryPool, firstQuery);
+  } else {
+    commandBuffer.writeTimestamp2(vk::PipelineStageFlagBits2::eComputeShader,
+                                  MStageQueryPool, firstQuery + stage);
+  }
+}
@@ -4,16 +4,94 @@
 #include <algorithm>
 #include <chrono>
 #include <cstring>
+#include <fcntl.h>
+#include <format>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
+#include <memory>
 #include <random>
 #include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-void vkParticle::updateUniformBuffer(uint32_t currentImage) {
-  // Update uniform buffer with a new time delta.
+void vkParticle::updateUniformBuffer(uint32_t outState, float deltaTime,
+                                     uint32_t particleCount) {
+  // Update uniform buffer with a new time delta and particle count.
   UniformBufferObject ubo{};
-  // `MLastFrameTime` set on each iteration of vkParticle::mainLoop()
-  ubo.deltaTime = static_cast<float>(MLastFrameTime) * 2.f;
-  memcpy(MUniformBuffersMapped[currentImage], &ubo, sizeof(ubo));
+  // `deltaTime` measured on each iteration of vkParticle::simulationLoop()
+  ubo.deltaTime = deltaTime;
+  // Invocations beyond the active count exit early in the compute shader
+  ubo.particleCount = particleCount;
+  // A zero strength leaves particles moving ballistically, the fused kernel
+  // instead enables the field with its own force module.
+  ubo.forceFieldStrength = MOptions.mode == SimulationMode::ForceField ||
+                                   MOptions.kernel == ComputeKernel::Fused
+                               ? SForceFieldStrength
+                               : 0.0f;
+  ubo.stepCount = MOptions.stepCount;
+  // Holds the electron plasma frequency as particles are added, half of
+  // them being electrons over the 2x2 window.
+  ubo.plasmaChargeScale =
+      usesPlasma() ? SPlasmaFrequency * SPlasmaFrequency * 8.0f / particleCount
+                   : 0.0f;
+  ubo.magneticField = MOptions.mode == SimulationMode::MagnetisedPlasma
+                          ? SPlasmaMagneticField
+                          : 0.0f;
+  // Total strength is held as particles are added
+  ubo.fmmOrder = MOptions.fmmOrder;
+  ubo.fmmStrength = SFmmGravity / particleCount;
+  if (MOptions.mode == SimulationMode::Brownian) {
+    ubo.brownianDamping = SBrownianDamping;
+    ubo.brownianTemperature = SBrownianTemperature;
+  }
+  // Each step draws fresh noise, keyed on the number of steps before it
+  ubo.seed = MSeed;
+  ubo.stepIndex = static_cast<uint32_t>(MComputeTimelineValue);
+  // Particles taken from the spawn ring for the step
+  ubo.spawnFirst = static_cast<uint32_t>(MSpawnFirst % SSpawnRingCapacity);
+  ubo.spawnCount = MSpawnCount;
+  ubo.spawnTarget = MSpawnTarget;
+  memcpy(MUniformBuffersMapped[outState], &ubo, sizeof(ubo));
+}
+
+HostMapping::HostMapping(const std::string &file, size_t size) : size(size) {
+  if (file.empty()) {
+    data = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+    // Fewer, larger pages for the device to translate when imported
+    if (data != MAP_FAILED) {
+      madvise(data, size, MADV_HUGEPAGE);
+    }
+#endif
+  } else {
+    int fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error(std::format("failed to open '{}'", file));
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0 ||
+        static_cast<size_t>(status.st_size) != size) {
+      close(fd);
+      throw std::runtime_error(
+          std::format("'{}' must hold {} bytes of particles", file, size));
+    }
+    // Mapped privately, so pages stay shared with the page cache unless
+    // written, but are writable as importing them may require.
+    data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+  }
+  if (data == MAP_FAILED) {
+    data = nullptr;
+    throw std::runtime_error("failed to map host memory!");
+  }
+}
+
+HostMapping::~HostMapping() {
+  if (data) {
+    munmap(data, size);
+  }
 }
 
 namespace {
@@ -32,6 +110,7 @@ uint32_t findMemoryType(vk::raii::PhysicalDevice &physicalDevice,
 
   throw std::runtime_error("failed to find suitable memory type!");
 }
+} // namespace
 
 void createBuffer(vk::raii::Device &device,
                   vk::raii::PhysicalDevice &physicalDevice, vk::DeviceSize size,
@@ -49,7 +128,6 @@ void createBuffer(vk::raii::Device &device,
   bufferMemory = vk::raii::DeviceMemory(device, allocInfo);
   buffer.bindMemory(bufferMemory, 0);
 }
-} // namespace
 
 void vkParticle::copyBuffer(vk::raii::Buffer &srcBuffer,
                             vk::raii::Buffer &dstBuffer, vk::DeviceSize size) {
@@ -75,28 +153,298 @@ void vkParticle::copyBuffer(vk::raii::Buffer &srcBuffer,
 
 void vkParticle::createShaderStorageBuffers() {
   // Setup random distribution to use for particle initial locations
-  std::default_random_engine rndEngine(static_cast<unsigned>(time(nullptr)));
+  std::default_random_engine rndEngine(MSeed);
   std::uniform_real_distribution rndDist(0.0f, 1.0f);
 
-  // Initialize host memory with particle instances
-  constexpr uint32_t ParticleCount = SComputeWorkItems * SComputeWorkGroups;
-  std::vector<Particle> particles(ParticleCount);
-  for (auto &particle : particles) {
-    // Initial particle positions on a circle
-    float r = 0.25f * sqrtf(rndDist(rndEngine));
-    float theta = rndDist(rndEngine) * 2.0f * 3.14159265358979323846f;
-    float x = r * cosf(theta) * SWindowHeight / SWindowWidth;
-    float y = r * sinf(theta);
-    particle.position = glm::vec2(x, y);
-    particle.velocity = normalize(glm::vec2(x, y)) * 0.00025f;
-    particle.color = glm::vec4(rndDist(rndEngine), rndDist(rndEngine),
-                               rndDist(rndEngine), 1.0f);
+  // Memory required for a buffer of all particles
+  vk::DeviceSize bufferSize = sizeof(Particle) * SMaxParticleCount;
+
+  // Initialize host memory with particle instances, for the full capacity
+  // so that particles becoming active later have an initial state. Either
+  // mapped from the initial state file, or generated into anonymous memory
+  // which can be imported like the file.
+  HostMapping hostParticles(MOptions.initialStateFile, bufferSize);
+  std::span particles(static_cast<Particle *>(hostParticles.data),
+                      SMaxParticleCount);
+  if (MOptions.initialStateFile.empty()) {
+    std::uninitialized_default_construct(particles.begin(), particles.end());
+    constexpr float Pi = 3.14159265358979323846f;
+    // Centres of the clusters of `Distribution::Clustered`
+    std::array<glm::vec2, 8> clusterCentres;
+    for (auto &centre : clusterCentres) {
+      centre = glm::vec2(rndDist(rndEngine), rndDist(rndEngine)) * 1.6f - 0.8f;
+    }
+    std::normal_distribution clusterDist(0.0f, 0.02f);
+    for (size_t i = 0; i < particles.size(); i++) {
+      Particle &particle = particles[i];
+      float theta = rndDist(rndEngine) * 2.0f * Pi;
+      switch (MOptions.distribution) {
+      case Distribution::Disc: {
+        // Initial particle positions on a circle
+        float r = 0.25f * sqrtf(rndDist(rndEngine));
+        float x = r * cosf(theta) * SWindowHeight / SWindowWidth;
+        float y = r * sinf(theta);
+        particle.position = glm::vec2(x, y);
+        particle.velocity = normalize(glm::vec2(x, y)) * 0.00025f;
+        break;
+      }
+      case Distribution::Uniform:
+        particle.position =
+            glm::vec2(rndDist(rndEngine), rndDist(rndEngine)) * 2.0f - 1.0f;
+        break;
+      case Distribution::Clustered:
+        particle.position =
+            clusterCentres[i % clusterCentres.size()] +
+            glm::vec2(clusterDist(rndEngine), clusterDist(rndEngine));
+        break;
+      case Distribution::Point: {
+        // Within a single fine grid cell, of the 256x256 over the window, by
+        // centring on the cell just above and right of the origin and
+        // keeping within half its width.
+        constexpr float FineCellSize = 2.0f / 256.0f;
+        particle.position = glm::vec2(FineCellSize / 2.0f) +
+                            glm::vec2(cosf(theta), sinf(theta)) * 0.002f *
+                                sqrtf(rndDist(rndEngine));
+        break;
+      }
+      }
+      if (MOptions.distribution != Distribution::Disc) {
+        particle.velocity = glm::vec2(cosf(theta), sinf(theta)) * 0.00025f;
+      }
+      particle.color = glm::vec4(rndDist(rndEngine), rndDist(rndEngine),
+                                 rndDist(rndEngine), 1.0f);
+      // Alternate electrons and ions, so that any active count, a multiple of
+      // the work-group size, is neutral.
+      bool electron = i % 2 == 0;
+      particle.charge = electron ? -1.0f : 1.0f;
+      particle.mass = electron ? 1.0f : SPlasmaIonMass;
+      if (usesPlasma()) {
+        particle.color = electron ? glm::vec4(0.3f, 0.6f, 1.0f, 1.0f)
+                                  : glm::vec4(1.0f, 0.4f, 0.3f, 1.0f);
+      }
+    }
+  }
+  if (MOptions.mode == SimulationMode::Clusters) {
+    createClusterBuffers(particles);
   }
 
-  // Memory required for a buffer of all particles
-  vk::DeviceSize bufferSize = sizeof(Particle) * ParticleCount;
+  // Buffer used to upload the initial particles to the gpu
+  vk::raii::Buffer stagingBuffer({});
+  vk::raii::DeviceMemory stagingBufferMemory({});
+  createInitialParticleBuffer(hostParticles, stagingBuffer,
+                              stagingBufferMemory);
+
+  MShaderStorageBuffers.clear();
+  MShaderStorageBuffersMemory.clear();
+
+  // Use single-shot command-buffer to copy initial particle data from
+  // temporary buffers to shader storage buffers.
+  // SSBs have usage flag bits set for storage and transfer, so that they can
+  // be used in compute shaders and data transferred from host to GPU. The
+  // graphics pipeline draws from `MRenderStreamBuffers` instead.
+  // Every simulation state starts with the same initial particle data, so the
+  // renderer has something to draw before the first step completes.
+  constexpr vk::BufferUsageFlags StorageUsage =
+      vk::BufferUsageFlagBits::eStorageBuffer |
+      vk::BufferUsageFlagBits::eTransferDst;
+
+  // With sparse storage the buffers reserve the full capacity of address
+  // space up front, so descriptors never need rewriting, but memory is only
+  // bound as the particle count grows.
+  if (MSparseStorage) {
+    for (size_t i = 0; i < SSimulationStateCount; i++) {
+      MShaderStorageBuffers.emplace_back(
+          MDevice, vk::BufferCreateInfo{
+                       .flags = vk::BufferCreateFlagBits::eSparseBinding |
+                                vk::BufferCreateFlagBits::eSparseResidency,
+                       .size = bufferSize,
+                       .usage = StorageUsage,
+                       .sharingMode = vk::SharingMode::eExclusive});
+    }
+    vk::MemoryRequirements memRequirements =
+        MShaderStorageBuffers.front().getMemoryRequirements();
+    MSparseMemoryType =
+        findMemoryType(MPhysicalDevice, memRequirements.memoryTypeBits,
+                       vk::MemoryPropertyFlagBits::eDeviceLocal);
+    // Commit memory in chunks of whole sparse blocks, large enough that the
+    // budget growing a work-group at a time rarely needs a bind.
+    MSparseChunkSize =
+        (std::max(SSparseChunkSize, memRequirements.alignment) +
+         memRequirements.alignment - 1) /
+        memRequirements.alignment * memRequirements.alignment;
+    MSparseStorageSize = memRequirements.size;
+    MCommittedParticles = 0;
+    ensureStorageCapacity(SMinParticleCount);
+    MUploadedParticles = MCommittedParticles;
+    for (vk::raii::Buffer &buffer : MShaderStorageBuffers) {
+      copyBuffer(stagingBuffer, buffer,
+                 sizeof(Particle) * MUploadedParticles);
+    }
+  } else {
+    for (size_t i = 0; i < SSimulationStateCount; i++) {
+      vk::raii::Buffer shaderStorageBufferTemp({});
+      vk::raii::DeviceMemory shaderStorageBufferTempMemory({});
+      createBuffer(MDevice, MPhysicalDevice, bufferSize, StorageUsage,
+                   vk::MemoryPropertyFlagBits::eDeviceLocal, // GPU resident
+                   shaderStorageBufferTemp, shaderStorageBufferTempMemory);
+      copyBuffer(stagingBuffer, shaderStorageBufferTemp, bufferSize);
+      MShaderStorageBuffers.emplace_back(std::move(shaderStorageBufferTemp));
+      MShaderStorageBuffersMemory.emplace_back(
+          std::move(shaderStorageBufferTempMemory));
+    }
+  }
 
-  // Create a host-visible staging buffer used to upload data to the gpu
+  createPrecisionErrorBuffers(stagingBuffer);
+  createRenderStreamBuffers(particles);
+  // Kept to initialise particles in memory committed later
+  if (MSparseStorage) {
+    MInitialParticleHost = std::move(hostParticles);
+    MInitialParticleBuffer = std::move(stagingBuffer);
+    MInitialParticleBufferMemory = std::move(stagingBufferMemory);
+  }
+}
+
+void vkParticle::createInitialParticleBuffer(
+    const HostMapping &hostParticles, vk::raii::Buffer &buffer,
+    vk::raii::DeviceMemory &bufferMemory) {
+  const vk::DeviceSize size = hostParticles.size;
+
+  // Imported memory must be aligned in both its address and size, which
+  // page aligned mappings of whole pages usually are.
+  constexpr vk::ExternalMemoryHandleTypeFlagBits HandleType =
+      vk::ExternalMemoryHandleTypeFlagBits::eHostAllocationEXT;
+  if (MSupportsHostImport &&
+      reinterpret_cast<uintptr_t>(hostParticles.data) % MHostImportAlignment ==
+          0 &&
+      size % MHostImportAlignment == 0 &&
+      (MPhysicalDevice
+           .getExternalBufferProperties(
+               {.usage = vk::BufferUsageFlagBits::eTransferSrc,
+                .handleType = HandleType})
+           .externalMemoryProperties.externalMemoryFeatures &
+       vk::ExternalMemoryFeatureFlagBits::eImportable)) {
+    // The driver may still refuse a pointer, such as a private mapping of a
+    // file, in which case the particles are copied as below.
+    try {
+      vk::ExternalMemoryBufferCreateInfo externalInfo{.handleTypes =
+                                                          HandleType};
+      buffer = vk::raii::Buffer(
+          MDevice, vk::BufferCreateInfo{
+                       .pNext = &externalInfo,
+                       .size = size,
+                       .usage = vk::BufferUsageFlagBits::eTransferSrc,
+                       .sharingMode = vk::SharingMode::eExclusive});
+      vk::MemoryRequirements memRequirements = buffer.getMemoryRequirements();
+      vk::MemoryHostPointerPropertiesEXT hostProperties =
+          MDevice.getMemoryHostPointerPropertiesEXT(HandleType,
+                                                    hostParticles.data);
+      const uint32_t memoryTypeBits =
+          memRequirements.memoryTypeBits & hostProperties.memoryTypeBits;
+      if (memoryTypeBits != 0) {
+        vk::ImportMemoryHostPointerInfoEXT importInfo{
+            .handleType = HandleType, .pHostPointer = hostParticles.data};
+        vk::MemoryAllocateInfo allocInfo{
+            .pNext = &importInfo,
+            .allocationSize = size,
+            .memoryTypeIndex =
+                findMemoryType(MPhysicalDevice, memoryTypeBits, {})};
+        bufferMemory = vk::raii::DeviceMemory(MDevice, allocInfo);
+        buffer.bindMemory(bufferMemory, 0);
+        return;
+      }
+    } catch (const vk::SystemError &) {
+    }
+  }
+
+  // Otherwise copy into a host-visible staging buffer
+  createBuffer(MDevice, MPhysicalDevice, size,
+               vk::BufferUsageFlagBits::eTransferSrc,
+               vk::MemoryPropertyFlagBits::eHostVisible |
+                   vk::MemoryPropertyFlagBits::eHostCoherent,
+               buffer, bufferMemory);
+  memcpy(bufferMemory.mapMemory(0, size), hostParticles.data, size);
+  bufferMemory.unmapMemory();
+}
+
+void vkParticle::ensureStorageCapacity(uint32_t particleCount) {
+  // Shape matching reads whole blocks of clusters, including those past the
+  // last active particle, so blocks are committed whole.
+  if (MOptions.mode == SimulationMode::Clusters) {
+    particleCount = (particleCount + SClusterBlockSize - 1) /
+                    SClusterBlockSize * SClusterBlockSize;
+  }
+  if (!MSparseStorage || particleCount <= MCommittedParticles) {
+    return;
+  }
+
+  // Bind a new chunk of memory to the next range of each state buffer. The
+  // chunks already bound, and the particles in them, are left untouched.
+  const vk::DeviceSize committedSize = MSparseMemory.size() /
+                                       SSimulationStateCount *
+                                       MSparseChunkSize;
+  const vk::DeviceSize requiredSize = sizeof(Particle) * particleCount;
+  std::array<std::vector<vk::SparseMemoryBind>, SSimulationStateCount> binds;
+  for (vk::DeviceSize offset = committedSize; offset < requiredSize;
+       offset += MSparseChunkSize) {
+    const vk::DeviceSize size =
+        std::min(MSparseChunkSize, MSparseStorageSize - offset);
+    for (uint32_t state = 0; state < SSimulationStateCount; state++) {
+      vk::raii::DeviceMemory &memory = MSparseMemory.emplace_back(
+          MDevice, vk::MemoryAllocateInfo{.allocationSize = size,
+                                          .memoryTypeIndex =
+                                              MSparseMemoryType});
+      binds[state].push_back(
+          {.resourceOffset = offset, .size = size, .memory = *memory});
+    }
+  }
+  std::array<vk::SparseBufferMemoryBindInfo, SSimulationStateCount> bufferBinds;
+  for (uint32_t state = 0; state < SSimulationStateCount; state++) {
+    bufferBinds[state] = {
+        .buffer = *MShaderStorageBuffers[state],
+        .bindCount = static_cast<uint32_t>(binds[state].size()),
+        .pBinds = binds[state].data()};
+  }
+
+  // Binding isn't ordered against submissions on the queue, so only this
+  // bind is waited on before the step using the memory is submitted. Steps
+  // in flight never touch the newly bound range.
+  vk::raii::Fence fence(MDevice, vk::FenceCreateInfo{});
+  {
+    auto lock = lockSharedQueue();
+    MComputeQueue.bindSparse(
+        vk::BindSparseInfo{.bufferBindCount =
+                               static_cast<uint32_t>(bufferBinds.size()),
+                           .pBufferBinds = bufferBinds.data()},
+        *fence);
+  }
+  while (vk::Result::eTimeout ==
+         MDevice.waitForFences(*fence, vk::True, UINT64_MAX))
+    ;
+
+  const vk::DeviceSize boundSize =
+      std::min(MSparseStorageSize, MSparseMemory.size() /
+                                       SSimulationStateCount *
+                                       MSparseChunkSize);
+  MCommittedParticles = std::min(
+      SMaxParticleCount, static_cast<uint32_t>(boundSize / sizeof(Particle)));
+}
+
+void vkParticle::createRenderStreamBuffers(
+    std::span<const Particle> particles) {
+  MRenderStreamBuffers.clear();
+  MRenderStreamBuffersMemory.clear();
+  if (!usesRenderStream()) {
+    return;
+  }
+
+  // Packed on the host the same way as `compRenderStream`, so that the
+  // initial states can be drawn before the first step writes a stream.
+  std::vector<RenderVertex> vertices(particles.size());
+  for (size_t i = 0; i < particles.size(); i++) {
+    vertices[i] = {.position = glm::packSnorm2x16(particles[i].position * 0.5f),
+                   .color = glm::packUnorm4x8(particles[i].color)};
+  }
+  vk::DeviceSize bufferSize = sizeof(RenderVertex) * vertices.size();
   vk::raii::Buffer stagingBuffer({});
   vk::raii::DeviceMemory stagingBufferMemory({});
   createBuffer(MDevice, MPhysicalDevice, bufferSize,
@@ -104,33 +452,22 @@ void vkParticle::createShaderStorageBuffers() {
                vk::MemoryPropertyFlagBits::eHostVisible |
                    vk::MemoryPropertyFlagBits::eHostCoherent,
                stagingBuffer, stagingBufferMemory);
-
-  // Map staging buffer buffer, and copy host std::vector data into it.
-  void *dataStaging = stagingBufferMemory.mapMemory(0, bufferSize);
-  memcpy(dataStaging, particles.data(), (size_t)bufferSize);
+  memcpy(stagingBufferMemory.mapMemory(0, bufferSize), vertices.data(),
+         bufferSize);
   stagingBufferMemory.unmapMemory();
 
-  MShaderStorageBuffers.clear();
-  MShaderStorageBuffersMemory.clear();
-
-  // Use single-shot command-buffer to copy initial particle data from
-  // temporary buffers to shader storage buffers.
-  // SSBs have usage flag bits set for all of storage, vertex, and transfer,
-  // so that they can be used in vertex shader and compute shader, and
-  // data transferred from host to GPU (for UBO with delta time).
-  for (size_t i = 0; i < SMaxFramesInFlight; i++) {
-    vk::raii::Buffer shaderStorageBufferTemp({});
-    vk::raii::DeviceMemory shaderStorageBufferTempMemory({});
+  for (size_t i = 0; i < SSimulationStateCount; i++) {
+    vk::raii::Buffer buffer({});
+    vk::raii::DeviceMemory bufferMemory({});
     createBuffer(MDevice, MPhysicalDevice, bufferSize,
                  vk::BufferUsageFlagBits::eStorageBuffer |
                      vk::BufferUsageFlagBits::eVertexBuffer |
                      vk::BufferUsageFlagBits::eTransferDst,
-                 vk::MemoryPropertyFlagBits::eDeviceLocal, // GPU resident
-                 shaderStorageBufferTemp, shaderStorageBufferTempMemory);
-    copyBuffer(stagingBuffer, shaderStorageBufferTemp, bufferSize);
-    MShaderStorageBuffers.emplace_back(std::move(shaderStorageBufferTemp));
-    MShaderStorageBuffersMemory.emplace_back(
-        std::move(shaderStorageBufferTempMemory));
+                 vk::MemoryPropertyFlagBits::eDeviceLocal, buffer,
+                 bufferMemory);
+    copyBuffer(stagingBuffer, buffer, bufferSize);
+    MRenderStreamBuffers.emplace_back(std::move(buffer));
+    MRenderStreamBuffersMemory.emplace_back(std::move(bufferMemory));
   }
 }
 
@@ -139,11 +476,11 @@ void vkParticle::createUniformBuffers() {
   MUniformBuffersMemory.clear();
   MUniformBuffersMapped.clear();
 
-  // Each frame has a host visible/coherent uniform buffer
+  // Each simulation state has a host visible/coherent uniform buffer
   // that is persistently mapped. This is used to pass in the
   // new time value to the compute shader, rather than passing
-  // this through the vertex buffer and updating that every frame.
-  for (size_t i = 0; i < SMaxFramesInFlight; i++) {
+  // this through the vertex buffer and updating that every step.
+  for (size_t i = 0; i < SSimulationStateCount; i++) {
     vk::DeviceSize bufferSize = sizeof(UniformBufferObject);
     vk::raii::Buffer buffer({});
     vk::raii::DeviceMemory bufferMem({});
@@ -158,3 +495,361 @@ void vkParticle::createUniformBuffers() {
         MUniformBuffersMemory[i].mapMemory(0, bufferSize));
   }
 }
+
+void vkParticle::createMultiRateBuffers() {
+  if (MOptions.kernel != ComputeKernel::MultiRate) {
+    return;
+  }
+
+  // Only a single simulation step is in flight at a time, so the bins are
+  // shared between all the simulation states. GPU resident as they are only
+  // written and read by compute.
+  createBuffer(MDevice, MPhysicalDevice, sizeof(uint32_t) * SMultiRateLevels,
+               vk::BufferUsageFlagBits::eStorageBuffer |
+                   vk::BufferUsageFlagBits::eTransferDst,
+               vk::MemoryPropertyFlagBits::eDeviceLocal, MMultiRateCountBuffer,
+               MMultiRateCountBufferMemory);
+  // Every particle could require the same timestep, so each bin has room for
+  // the maximum number of particles.
+  createBuffer(MDevice, MPhysicalDevice,
+               sizeof(uint32_t) * SMultiRateLevels * SMaxParticleCount,
+               vk::BufferUsageFlagBits::eStorageBuffer,
+               vk::MemoryPropertyFlagBits::eDeviceLocal, MMultiRateIndexBuffer,
+               MMultiRateIndexBufferMemory);
+  // Written by a compute shader, and read as indirect dispatch arguments.
+  createBuffer(MDevice, MPhysicalDevice,
+               sizeof(vk::DispatchIndirectCommand) * SMultiRateLevels,
+               vk::BufferUsageFlagBits::eStorageBuffer |
+                   vk::BufferUsageFlagBits::eIndirectBuffer,
+               vk::MemoryPropertyFlagBits::eDeviceLocal, MMultiRateArgsBuffer,
+               MMultiRateArgsBufferMemory);
+}
+
+void vkParticle::createPrecisionErrorBuffers(vk::raii::Buffer &stagingBuffer) {
+  if (MOptions.kernel != ComputeKernel::Half || !MOptions.stats) {
+    return;
+  }
+
+  // Reference state starts from the same initial particle data as the
+  // simulation states, and is updated in place so only one copy is needed.
+  vk::DeviceSize bufferSize = sizeof(Particle) * SMaxParticleCount;
+  createBuffer(MDevice, MPhysicalDevice, bufferSize,
+               vk::BufferUsageFlagBits::eStorageBuffer |
+                   vk::BufferUsageFlagBits::eTransferDst,
+               vk::MemoryPropertyFlagBits::eDeviceLocal, MReferenceBuffer,
+               MReferenceBufferMemory);
+  copyBuffer(stagingBuffer, MReferenceBuffer, bufferSize);
+
+  // Error is read back by the simulation thread after every step, so keep it
+  // host visible and persistently mapped.
+  createBuffer(MDevice, MPhysicalDevice, sizeof(uint32_t),
+               vk::BufferUsageFlagBits::eStorageBuffer |
+                   vk::BufferUsageFlagBits::eTransferDst,
+               vk::MemoryPropertyFlagBits::eHostVisible |
+                   vk::MemoryPropertyFlagBits::eHostCoherent,
+               MPrecisionErrorBuffer, MPrecisionErrorBufferMemory);
+  MPrecisionErrorMapped = static_cast<uint32_t *>(
+      MPrecisionErrorBufferMemory.mapMemory(0, sizeof(uint32_t)));
+}
+
+void vkParticle::createGridBuffers() {
+  if (!usesGrid()) {
+    return;
+  }
+
+  // Counts and starts have an extra element past the last cell, which is
+  // never counted into so that its start is the total particle count.
+  constexpr vk::DeviceSize CellBufferSize =
+      sizeof(uint32_t) * (SGridCellCount + 1);
+  createBuffer(MDevice, MPhysicalDevice, CellBufferSize,
+               vk::BufferUsageFlagBits::eStorageBuffer |
+                   vk::BufferUsageFlagBits::eTransferDst,
+               vk::MemoryPropertyFlagBits::eDeviceLocal, MGridCellCountBuffer,
+               MGridCellCountBufferMemory);
+  createBuffer(MDevice, MPhysicalDevice, CellBufferSize,
+               vk::BufferUsageFlagBits::eStorageBuffer,
+               vk::MemoryPropertyFlagBits::eDeviceLocal, MGridCellStartBuffer,
+               MGridCellStartBufferMemory);
+  createBuffer(MDevice, MPhysicalDevice, sizeof(uint32_t) * SMaxParticleCount,
+               vk::BufferUsageFlagBits::eStorageBuffer,
+               vk::MemoryPropertyFlagBits::eDeviceLocal, MGridSortedBuffer,
+               MGridSortedBufferMemory);
+  createBuffer(MDevice, MPhysicalDevice, sizeof(uint32_t) * SMaxParticleCount,
+               vk::BufferUsageFlagBits::eStorageBuffer,
+               vk::MemoryPropertyFlagBits::eDeviceLocal, MGridSortedCellBuffer,
+               MGridSortedCellBufferMemory);
+  // Incremental builds also scan a flag per particle
+  bool incremental = MOptions.gridChurnThreshold > 0;
+  uint32_t scanCount = incremental
+                           ? std::max(SGridCellCount + 1, SMaxParticleCount)
+                           : SGridCellCount + 1;
+  createBuffer(MDevice, MPhysicalDevice, primitiveScratchSize(scanCount),
+               vk::BufferUsageFlagBits::eStorageBuffer |
+                   vk::BufferUsageFlagBits::eTransferDst,
+               vk::MemoryPropertyFlagBits::eDeviceLocal, MGridScratchBuffer,
+               MGridScratchBufferMemory);
+  if (!incremental) {
+    return;
+  }
+
+  constexpr vk::DeviceSize ParticleBufferSize =
+      sizeof(uint32_t) * SMaxParticleCount;
+  createBuffer(MDevice, MPhysicalDevice, ParticleBufferSize,
+               vk::BufferUsageFlagBits::eStorageBuffer,
+               vk::MemoryPropertyFlagBits::eDeviceLocal, MGridSlotIndexBuffer,
+               MGridSlotIndexBufferMemory);
+  createBuffer(MDevice, MPhysicalDevice, ParticleBufferSize,
+               vk::BufferUsageFlagBits::eStorageBuffer,
+               vk::MemoryPropertyFlagBits::eDeviceLocal, MGridSlotCellBuffer,
+               MGridSlotCellBufferMemory);
+  createBuffer(MDevice, MPhysicalDevice, ParticleBufferSize,
+               vk::BufferUsageFlagBits::eStorageBuffer,
+               vk::MemoryPropertyFlagBits::eDeviceLocal, MGridStayFlagBuffer,
+               MGridStayFlagBufferMemory);
+  createBuffer(MDevice, MPhysicalDevice, ParticleBufferSize,
+               vk::BufferUsageFlagBits::eStorageBuffer,
+               vk::MemoryPropertyFlagBits::eDeviceLocal, MGridStayRankBuffer,
+               MGridStayRankBufferMemory);
+  createBuffer(MDevice, MPhysicalDevice, CellBufferSize,
+               vk::BufferUsageFlagBits::eStorageBuffer |
+                   vk::BufferUsageFlagBits::eTransferDst,
+               vk::MemoryPropertyFlagBits::eDeviceLocal,
+               MGridDepartureCountBuffer, MGridDepartureCountBufferMemory);
+  createBuffer(MDevice, MPhysicalDevice, CellBufferSize,
+               vk::BufferUsageFlagBits::eStorageBuffer,
+               vk::MemoryPropertyFlagBits::eDeviceLocal,
+               MGridDepartureStartBuffer, MGridDepartureStartBufferMemory);
+  createBuffer(MDevice, MPhysicalDevice, CellBufferSize,
+               vk::BufferUsageFlagBits::eStorageBuffer,
+               vk::MemoryPropertyFlagBits::eDeviceLocal,
+               MGridArrivalStartBuffer, MGridArrivalStartBufferMemory);
+
+  // Churn is read back by the simulation thread to pick how the next step
+  // builds the grid, so keep it host visible and persistently mapped.
+  createBuffer(MDevice, MPhysicalDevice, sizeof(uint32_t),
+               vk::BufferUsageFlagBits::eStorageBuffer |
+                   vk::BufferUsageFlagBits::eTransferDst,
+               vk::MemoryPropertyFlagBits::eHostVisible |
+                   vk::MemoryPropertyFlagBits::eHostCoherent,
+               MGridChurnBuffer, MGridChurnBufferMemory);
+  MGridChurnMapped = static_cast<uint32_t *>(
+      MGridChurnBufferMemory.mapMemory(0, sizeof(uint32_t)));
+  *MGridChurnMapped = 0;
+}
+
+void vkParticle::createNeighbourListBuffers() {
+  if (!MOptions.neighbourLists) {
+    return;
+  }
+
+  // Lists are indexed by particle, which is the same in every state, so
+  // they are shared between the states like the grid.
+  createBuffer(MDevice, MPhysicalDevice,
+               sizeof(uint32_t) * SNeighbourCapacity * SMaxParticleCount,
+               vk::BufferUsageFlagBits::eStorageBuffer,
+               vk::MemoryPropertyFlagBits::eDeviceLocal, MNeighbourListBuffer,
+               MNeighbourListBufferMemory);
+  createBuffer(MDevice, MPhysicalDevice, sizeof(uint32_t) * SMaxParticleCount,
+               vk::BufferUsageFlagBits::eStorageBuffer,
+               vk::MemoryPropertyFlagBits::eDeviceLocal, MNeighbourCountBuffer,
+               MNeighbourCountBufferMemory);
+  createBuffer(MDevice, MPhysicalDevice, sizeof(glm::vec2) * SMaxParticleCount,
+               vk::BufferUsageFlagBits::eStorageBuffer,
+               vk::MemoryPropertyFlagBits::eDeviceLocal,
+               MNeighbourOriginBuffer, MNeighbourOriginBufferMemory);
+  createBuffer(MDevice, MPhysicalDevice, sizeof(uint32_t) * SMaxParticleCount,
+               vk::BufferUsageFlagBits::eStorageBuffer,
+               vk::MemoryPropertyFlagBits::eDeviceLocal,
+               MNeighbourDisplacementBuffer,
+               MNeighbourDisplacementBufferMemory);
+
+  // Reduction results are read back by the simulation thread after every
+  // step, so keep them host visible and persistently mapped. Reductions
+  // clear their output with a fill first.
+  createBuffer(MDevice, MPhysicalDevice, sizeof(uint32_t),
+               vk::BufferUsageFlagBits::eStorageBuffer |
+                   vk::BufferUsageFlagBits::eTransferDst,
+               vk::MemoryPropertyFlagBits::eHostVisible |
+                   vk::MemoryPropertyFlagBits::eHostCoherent,
+               MNeighbourMaxDisplacementBuffer,
+               MNeighbourMaxDisplacementBufferMemory);
+  MNeighbourMaxDisplacementMapped = static_cast<uint32_t *>(
+      MNeighbourMaxDisplacementBufferMemory.mapMemory(0, sizeof(uint32_t)));
+  createBuffer(MDevice, MPhysicalDevice, sizeof(uint32_t),
+               vk::BufferUsageFlagBits::eStorageBuffer |
+                   vk::BufferUsageFlagBits::eTransferDst,
+               vk::MemoryPropertyFlagBits::eHostVisible |
+                   vk::MemoryPropertyFlagBits::eHostCoherent,
+               MNeighbourTotalBuffer, MNeighbourTotalBufferMemory);
+  MNeighbourTotalMapped = static_cast<uint32_t *>(
+      MNeighbourTotalBufferMemory.mapMemory(0, sizeof(uint32_t)));
+  createBuffer(MDevice, MPhysicalDevice, sizeof(uint32_t),
+               vk::BufferUsageFlagBits::eStorageBuffer |
+                   vk::BufferUsageFlagBits::eTransferDst,
+               vk::MemoryPropertyFlagBits::eHostVisible |
+                   vk::MemoryPropertyFlagBits::eHostCoherent,
+               MNeighbourMaxCountBuffer, MNeighbourMaxCountBufferMemory);
+  MNeighbourMaxCountMapped = static_cast<uint32_t *>(
+      MNeighbourMaxCountBufferMemory.mapMemory(0, sizeof(uint32_t)));
+  *MNeighbourMaxDisplacementMapped = 0;
+  *MNeighbourTotalMapped = 0;
+  *MNeighbourMaxCountMapped = 0;
+}
+
+void vkParticle::createSpatialQueryBuffers() {
+  if (!MOptions.spatialQueries) {
+    return;
+  }
+
+  // Queries are written and results read by the simulation thread on every
+  // step answering queries, so keep both host visible and persistently
+  // mapped.
+  constexpr vk::DeviceSize QueryBufferSize =
+      sizeof(SpatialQuery) * SMaxSpatialQueries;
+  createBuffer(MDevice, MPhysicalDevice, QueryBufferSize,
+               vk::BufferUsageFlagBits::eStorageBuffer,
+               vk::MemoryPropertyFlagBits::eHostVisible |
+                   vk::MemoryPropertyFlagBits::eHostCoherent,
+               MSpatialQueryBuffer, MSpatialQueryBufferMemory);
+  MSpatialQueryMapped = static_cast<SpatialQuery *>(
+      MSpatialQueryBufferMemory.mapMemory(0, QueryBufferSize));
+  constexpr vk::DeviceSize ResultBufferSize =
+      sizeof(uint32_t) * (SSpatialQueryCapacity + 1) * SMaxSpatialQueries;
+  createBuffer(MDevice, MPhysicalDevice, ResultBufferSize,
+               vk::BufferUsageFlagBits::eStorageBuffer,
+               vk::MemoryPropertyFlagBits::eHostVisible |
+                   vk::MemoryPropertyFlagBits::eHostCoherent,
+               MSpatialResultBuffer, MSpatialResultBufferMemory);
+  MSpatialResultMapped = static_cast<uint32_t *>(
+      MSpatialResultBufferMemory.mapMemory(0, ResultBufferSize));
+}
+
+void vkParticle::createSpawnRingBuffer() {
+  if (!MOptions.injection) {
+    return;
+  }
+
+  // Written by producers on any thread and read in place by the step
+  // injecting from it, so host visible and persistently mapped.
+  constexpr vk::DeviceSize RingSize = sizeof(SpawnRecord) * SSpawnRingCapacity;
+  createBuffer(MDevice, MPhysicalDevice, RingSize,
+               vk::BufferUsageFlagBits::eStorageBuffer,
+               vk::MemoryPropertyFlagBits::eHostVisible |
+                   vk::MemoryPropertyFlagBits::eHostCoherent,
+               MSpawnRingBuffer, MSpawnRingBufferMemory);
+  MSpawnRingMapped = static_cast<SpawnRecord *>(
+      MSpawnRingBufferMemory.mapMemory(0, RingSize));
+  // Value initialized to zero, which no position publishes
+  MSpawnSequences =
+      std::make_unique<std::atomic<uint64_t>[]>(SSpawnRingCapacity);
+}
+
+void vkParticle::createPlasmaBuffers() {
+  if (!usesPlasma()) {
+    return;
+  }
+
+  // Only touched by compute, other than fills clearing the charge each step
+  // and the potential before the first.
+  createBuffer(MDevice, MPhysicalDevice, sizeof(int32_t) * SPlasmaNodeCount,
+               vk::BufferUsageFlagBits::eStorageBuffer |
+                   vk::BufferUsageFlagBits::eTransferDst,
+               vk::MemoryPropertyFlagBits::eDeviceLocal, MPlasmaChargeBuffer,
+               MPlasmaChargeBufferMemory);
+  createBuffer(MDevice, MPhysicalDevice, sizeof(float) * SPlasmaNodeCount,
+               vk::BufferUsageFlagBits::eStorageBuffer |
+                   vk::BufferUsageFlagBits::eTransferDst,
+               vk::MemoryPropertyFlagBits::eDeviceLocal,
+               MPlasmaPotentialBuffer, MPlasmaPotentialBufferMemory);
+  createBuffer(MDevice, MPhysicalDevice,
+               sizeof(glm::vec2) * SPlasmaNodeCount,
+               vk::BufferUsageFlagBits::eStorageBuffer,
+               vk::MemoryPropertyFlagBits::eDeviceLocal, MPlasmaFieldBuffer,
+               MPlasmaFieldBufferMemory);
+}
+
+void vkParticle::createFluidBuffers() {
+  if (MOptions.mode != SimulationMode::Fluid) {
+    return;
+  }
+
+  // Only touched by compute, other than fills clearing the accumulated
+  // momentum, weights and cell counts each step and the pressure before the
+  // first.
+  constexpr auto ClearedUsage = vk::BufferUsageFlagBits::eStorageBuffer |
+                                vk::BufferUsageFlagBits::eTransferDst;
+  // Both components of the integer and float face buffers are 4 bytes
+  constexpr vk::DeviceSize FaceBufferSize = sizeof(float) * 2 * SFluidFaceCount;
+  createBuffer(MDevice, MPhysicalDevice, FaceBufferSize, ClearedUsage,
+               vk::MemoryPropertyFlagBits::eDeviceLocal, MFluidMomentumBuffer,
+               MFluidMomentumBufferMemory);
+  createBuffer(MDevice, MPhysicalDevice, FaceBufferSize, ClearedUsage,
+               vk::MemoryPropertyFlagBits::eDeviceLocal, MFluidWeightBuffer,
+               MFluidWeightBufferMemory);
+  createBuffer(MDevice, MPhysicalDevice, FaceBufferSize,
+               vk::BufferUsageFlagBits::eStorageBuffer,
+               vk::MemoryPropertyFlagBits::eDeviceLocal, MFluidVelocityBuffer,
+               MFluidVelocityBufferMemory);
+  createBuffer(MDevice, MPhysicalDevice, FaceBufferSize,
+               vk::BufferUsageFlagBits::eStorageBuffer,
+               vk::MemoryPropertyFlagBits::eDeviceLocal,
+               MFluidSavedVelocityBuffer, MFluidSavedVelocityBufferMemory);
+  createBuffer(MDevice, MPhysicalDevice, sizeof(uint32_t) * SFluidCellCount,
+               ClearedUsage, vk::MemoryPropertyFlagBits::eDeviceLocal,
+               MFluidCellCountBuffer, MFluidCellCountBufferMemory);
+  createBuffer(MDevice, MPhysicalDevice, sizeof(float) * SFluidCellCount,
+               vk::BufferUsageFlagBits::eStorageBuffer,
+               vk::MemoryPropertyFlagBits::eDeviceLocal,
+               MFluidDivergenceBuffer, MFluidDivergenceBufferMemory);
+  createBuffer(MDevice, MPhysicalDevice, 2 * sizeof(float) * SFluidCellCount,
+               ClearedUsage, vk::MemoryPropertyFlagBits::eDeviceLocal,
+               MFluidPressureBuffer, MFluidPressureBufferMemory);
+}
+
+void vkParticle::createFmmBuffers() {
+  if (MOptions.kernel != ComputeKernel::Fmm) {
+    return;
+  }
+
+  constexpr vk::DeviceSize ExpansionBufferSize =
+      sizeof(glm::vec2) * (SFmmMaxOrder + 1) * SFmmCellCount;
+  createBuffer(MDevice, MPhysicalDevice, ExpansionBufferSize,
+               vk::BufferUsageFlagBits::eStorageBuffer,
+               vk::MemoryPropertyFlagBits::eDeviceLocal, MFmmMultipoleBuffer,
+               MFmmMultipoleBufferMemory);
+  createBuffer(MDevice, MPhysicalDevice, ExpansionBufferSize,
+               vk::BufferUsageFlagBits::eStorageBuffer,
+               vk::MemoryPropertyFlagBits::eDeviceLocal, MFmmLocalBuffer,
+               MFmmLocalBufferMemory);
+  // Copied out by the benchmark to compare against the reference
+  createBuffer(MDevice, MPhysicalDevice,
+               sizeof(glm::vec2) * SMaxParticleCount,
+               vk::BufferUsageFlagBits::eStorageBuffer |
+                   vk::BufferUsageFlagBits::eTransferSrc,
+               vk::MemoryPropertyFlagBits::eDeviceLocal, MFmmFieldBuffer,
+               MFmmFieldBufferMemory);
+  if (MOptions.benchmarkFmm) {
+    constexpr vk::DeviceSize ReferenceBufferSize =
+        sizeof(glm::vec2) * SFmmSampleCount;
+    createBuffer(MDevice, MPhysicalDevice, ReferenceBufferSize,
+                 vk::BufferUsageFlagBits::eStorageBuffer,
+                 vk::MemoryPropertyFlagBits::eHostVisible |
+                     vk::MemoryPropertyFlagBits::eHostCoherent,
+                 MFmmReferenceBuffer, MFmmReferenceBufferMemory);
+    MFmmReferenceMapped = static_cast<glm::vec2 *>(
+        MFmmReferenceBufferMemory.mapMemory(0, ReferenceBufferSize));
+  }
+}
+
+void vkParticle::createWorkQueueBuffer() {
+  if (!usesWorkQueue()) {
+    return;
+  }
+
+  // Single counter, reset each step and only touched by compute
+  createBuffer(MDevice, MPhysicalDevice, sizeof(uint32_t),
+               vk::BufferUsageFlagBits::eStorageBuffer |
+                   vk::BufferUsageFlagBits::eTransferDst,
+               vk::MemoryPropertyFlagBits::eDeviceLocal, MWorkQueueBuffer,
+               MWorkQueueBufferMemory);
+}
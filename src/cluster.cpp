@@ -0,0 +1,93 @@
+// Copyright (c) 2025-2026 Ewan Crawford
+
+#include "common.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <functional>
+#include <random>
+
+void vkParticle::createClusterBuffers(std::span<Particle> particles) {
+  std::default_random_engine rndEngine(MSeed);
+  std::uniform_real_distribution rndDist(0.0f, 1.0f);
+  std::uniform_int_distribution<uint32_t> sizeDist(
+      std::countr_zero(SMinClusterSize), std::countr_zero(SMaxClusterSize));
+  constexpr float Pi = 3.14159265358979323846f;
+
+  std::vector<ClusterRange> ranges;
+  std::vector<ClusterMember> members(particles.size());
+  for (uint32_t blockStart = 0; blockStart < particles.size();
+       blockStart += SClusterBlockSize) {
+    // Fill the block with random power of two sizes, placed largest first so
+    // that each starts at a multiple of its size.
+    std::vector<uint32_t> sizes;
+    for (uint32_t filled = 0; filled < SClusterBlockSize;) {
+      uint32_t size = std::min(1u << sizeDist(rndEngine),
+                               std::bit_floor(SClusterBlockSize - filled));
+      sizes.push_back(size);
+      filled += size;
+    }
+    std::ranges::sort(sizes, std::greater());
+
+    uint32_t start = blockStart;
+    for (uint32_t size : sizes) {
+      const uint32_t cluster = static_cast<uint32_t>(ranges.size());
+      // Alternate rigid and soft clusters
+      ranges.push_back({.start = start,
+                        .count = size,
+                        .stiffness =
+                            cluster % 2 == 0 ? 1.0f : SSoftClusterStiffness});
+
+      // Each cluster is a disc of particles, sized to keep their density
+      // even, drifting together.
+      glm::vec2 centre(rndDist(rndEngine) * 1.6f - 0.8f,
+                       rndDist(rndEngine) * 1.2f - 0.8f);
+      float radius = 0.004f * sqrtf(static_cast<float>(size));
+      float theta = rndDist(rndEngine) * 2.0f * Pi;
+      glm::vec2 velocity = glm::vec2(cosf(theta), sinf(theta)) * 0.00025f;
+      glm::vec4 color(rndDist(rndEngine), rndDist(rndEngine),
+                      rndDist(rndEngine), 1.0f);
+      glm::vec2 massCentre(0.0f);
+      float mass = 0.0f;
+      for (uint32_t i = start; i < start + size; i++) {
+        float r = radius * sqrtf(rndDist(rndEngine));
+        float angle = rndDist(rndEngine) * 2.0f * Pi;
+        particles[i].position =
+            centre + r * glm::vec2(cosf(angle), sinf(angle));
+        particles[i].velocity = velocity;
+        particles[i].color = color;
+        massCentre += particles[i].mass * particles[i].position;
+        mass += particles[i].mass;
+      }
+      massCentre /= mass;
+      for (uint32_t i = start; i < start + size; i++) {
+        members[i] = {.restOffset = particles[i].position - massCentre,
+                      .cluster = cluster};
+      }
+      start += size;
+    }
+  }
+
+  // Read only by compute, so uploaded once through a staging buffer
+  auto upload = [&](const void *data, vk::DeviceSize size,
+                    vk::raii::Buffer &buffer, vk::raii::DeviceMemory &memory) {
+    vk::raii::Buffer stagingBuffer({});
+    vk::raii::DeviceMemory stagingBufferMemory({});
+    createBuffer(MDevice, MPhysicalDevice, size,
+                 vk::BufferUsageFlagBits::eTransferSrc,
+                 vk::MemoryPropertyFlagBits::eHostVisible |
+                     vk::MemoryPropertyFlagBits::eHostCoherent,
+                 stagingBuffer, stagingBufferMemory);
+    memcpy(stagingBufferMemory.mapMemory(0, size), data, size);
+    stagingBufferMemory.unmapMemory();
+    createBuffer(MDevice, MPhysicalDevice, size,
+                 vk::BufferUsageFlagBits::eStorageBuffer |
+                     vk::BufferUsageFlagBits::eTransferDst,
+                 vk::MemoryPropertyFlagBits::eDeviceLocal, buffer, memory);
+    copyBuffer(stagingBuffer, buffer, size);
+  };
+  upload(ranges.data(), sizeof(ClusterRange) * ranges.size(),
+         MClusterRangeBuffer, MClusterRangeBufferMemory);
+  upload(members.data(), sizeof(ClusterMember) * members.size(),
+         MClusterMemberBuffer, MClusterMemberBufferMemory);
+}
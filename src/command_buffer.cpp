@@ -1,6 +1,8 @@
 // Copyright (c) 2025-2026 Ewan Crawford
 
 #include "common.hpp"
+#include <algorithm>
+#include <bit>
 
 void vkParticle::createCommandPool() {
   // Reset command-buffer bit means that command-buffers can be reset
@@ -10,6 +12,9 @@ void vkParticle::createCommandPool() {
       .flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
       .queueFamilyIndex = MQueueIndex};
   MCommandPool = vk::raii::CommandPool(MDevice, poolInfo);
+  // Command pools are externally synchronized, so the simulation thread
+  // allocates its command-buffers from a pool of its own.
+  MComputeCommandPool = vk::raii::CommandPool(MDevice, poolInfo);
 }
 
 void vkParticle::createGraphicsCommandBuffers() {
@@ -26,11 +31,12 @@ void vkParticle::createGraphicsCommandBuffers() {
 void vkParticle::createComputeCommandBuffers() {
   MComputeCommandBuffers.clear();
   // Use primary command-buffers, as they are submitted directly to a queue,
-  // rather than indirectly from other command-buffers.
+  // rather than indirectly from other command-buffers. There is one for each
+  // simulation state, as only a single step can write a state at a time.
   vk::CommandBufferAllocateInfo allocInfo{
-      .commandPool = MCommandPool,
+      .commandPool = MComputeCommandPool,
       .level = vk::CommandBufferLevel::ePrimary,
-      .commandBufferCount = SMaxFramesInFlight};
+      .commandBufferCount = SSimulationStateCount};
   MComputeCommandBuffers = vk::raii::CommandBuffers(MDevice, allocInfo);
 }
 
@@ -70,12 +76,48 @@ void transitionImageLayout(vk::raii::CommandBuffer &commandBuffer,
 }
 } // anonymous namespace
 
+void memoryBarrier(vk::raii::CommandBuffer &commandBuffer,
+                   vk::PipelineStageFlags2 srcStageMask,
+                   vk::AccessFlags2 srcAccessMask,
+                   vk::PipelineStageFlags2 dstStageMask,
+                   vk::AccessFlags2 dstAccessMask) {
+  // A global memory barrier applies to all buffers, which is simpler than
+  // buffer barriers when a pass reads back everything the last pass wrote.
+  vk::MemoryBarrier2 barrier = {.srcStageMask = srcStageMask,
+                                .srcAccessMask = srcAccessMask,
+                                .dstStageMask = dstStageMask,
+                                .dstAccessMask = dstAccessMask};
+  vk::DependencyInfo dependency_info = {.dependencyFlags = {},
+                                        .memoryBarrierCount = 1,
+                                        .pMemoryBarriers = &barrier};
+  commandBuffer.pipelineBarrier2(dependency_info);
+}
+
 void vkParticle::recordGraphicsCommandBuffer(uint32_t imageIndex) {
   MGraphicsCommandBuffers[MCurrentFrame].reset();
 
   // Don't need to set one-time-submit, simultanteous-ues, or render-pass flags
   MGraphicsCommandBuffers[MCurrentFrame].begin({});
 
+  // Time the frame so that the particle budget can account for render cost
+  if (MTimestampPeriod > 0.0f) {
+    MGraphicsCommandBuffers[MCurrentFrame].resetQueryPool(
+        MGraphicsQueryPool, MCurrentFrame * 2, 2);
+    MGraphicsCommandBuffers[MCurrentFrame].writeTimestamp2(
+        vk::PipelineStageFlagBits2::eTopOfPipe, MGraphicsQueryPool,
+        MCurrentFrame * 2);
+  }
+
+  if (MComputePresent) {
+    recordSplatCommands(imageIndex);
+    MGraphicsCommandBuffers[MCurrentFrame].end();
+    return;
+  }
+  // Surface thickness is prepared by compute before rendering starts
+  if (MOptions.renderer == Renderer::Surface) {
+    recordSurfaceCommands();
+  }
+
   // Before starting rendering, transition the swapchain image to
   // optimal color attachment
   transitionImageLayout(
@@ -108,9 +150,6 @@ void vkParticle::recordGraphicsCommandBuffer(uint32_t imageIndex) {
       .pColorAttachments = &attachmentInfo};
   MGraphicsCommandBuffers[MCurrentFrame].beginRendering(renderingInfo);
 
-  // Bind command-buffer to graphics pipeline
-  MGraphicsCommandBuffers[MCurrentFrame].bindPipeline(
-      vk::PipelineBindPoint::eGraphics, *MGraphicsPipeline);
   // Set dynamic viewport and scissor state to full swapchain dimensions
   MGraphicsCommandBuffers[MCurrentFrame].setViewport(
       0, vk::Viewport(0.0f, 0.0f, static_cast<float>(MSwapChainExtent.width),
@@ -118,19 +157,39 @@ void vkParticle::recordGraphicsCommandBuffer(uint32_t imageIndex) {
   MGraphicsCommandBuffers[MCurrentFrame].setScissor(
       0, vk::Rect2D(vk::Offset2D(0, 0), MSwapChainExtent));
 
-  // Bind command-buffer to buffer with GPU visible data used for vertex buffer
-  // input.
-  MGraphicsCommandBuffers[MCurrentFrame].bindVertexBuffers(
-      0, {MShaderStorageBuffers[MCurrentFrame]}, {0});
-
-  // Draw each of our particles, without using an index buffer as we're using
-  // dots for vertices rather than triangles
-  constexpr uint32_t ParticleCount = SComputeWorkItems * SComputeWorkGroups;
-  MGraphicsCommandBuffers[MCurrentFrame].draw(ParticleCount, 1,
-                                              0 /* offset into SV_VertexId*/,
-                                              0 /* offset into SV_InstanceID*/);
+  if (MOptions.renderer == Renderer::Surface) {
+    // Shade the smoothed thickness with a single full screen triangle
+    MGraphicsCommandBuffers[MCurrentFrame].bindPipeline(
+        vk::PipelineBindPoint::eGraphics, *MSurfaceShadePipeline);
+    MGraphicsCommandBuffers[MCurrentFrame].bindDescriptorSets(
+        vk::PipelineBindPoint::eGraphics, MSurfacePipelineLayout, 1,
+        {MSurfaceDescriptorSets[MRenderState]}, {});
+    MGraphicsCommandBuffers[MCurrentFrame].draw(3, 1, 0, 0);
+  } else {
+    // Bind command-buffer to graphics pipeline
+    MGraphicsCommandBuffers[MCurrentFrame].bindPipeline(
+        vk::PipelineBindPoint::eGraphics, *MGraphicsPipeline);
+
+    // Bind command-buffer to buffer with GPU visible data used for vertex
+    // buffer input, which is the latest state picked up from the simulation
+    // thread.
+    MGraphicsCommandBuffers[MCurrentFrame].bindVertexBuffers(
+        0, {MRenderStreamBuffers[MRenderState]}, {0});
+
+    // Draw each of the particles active in the state, without using an index
+    // buffer as we're using dots for vertices rather than triangles
+    MGraphicsCommandBuffers[MCurrentFrame].draw(
+        MSimulationStates[MRenderState].particleCount, 1,
+        0 /* offset into SV_VertexId*/, 0 /* offset into SV_InstanceID*/);
+  }
   MGraphicsCommandBuffers[MCurrentFrame].endRendering();
 
+  if (MTimestampPeriod > 0.0f) {
+    MGraphicsCommandBuffers[MCurrentFrame].writeTimestamp2(
+        vk::PipelineStageFlagBits2::eColorAttachmentOutput, MGraphicsQueryPool,
+        MCurrentFrame * 2 + 1);
+  }
+
   // After rendering, transition the swapchain image to present src layout
   transitionImageLayout(
       MGraphicsCommandBuffers[MCurrentFrame], MSwapChainImages[imageIndex],
@@ -146,20 +205,533 @@ void vkParticle::recordGraphicsCommandBuffer(uint32_t imageIndex) {
   MGraphicsCommandBuffers[MCurrentFrame].end();
 }
 
-void vkParticle::recordComputeCommandBuffer() {
-  MComputeCommandBuffers[MCurrentFrame].reset();
+void vkParticle::recordSplatCommands(uint32_t imageIndex) {
+  vk::raii::CommandBuffer &commandBuffer =
+      MGraphicsCommandBuffers[MCurrentFrame];
+
+  // Storage images are written in the general layout, there is no render
+  // pass to transition the image to a color attachment.
+  transitionImageLayout(commandBuffer, MSwapChainImages[imageIndex],
+                        vk::ImageLayout::eUndefined, vk::ImageLayout::eGeneral,
+                        {}, vk::AccessFlagBits2::eShaderStorageWrite,
+                        vk::PipelineStageFlagBits2::eTopOfPipe,
+                        vk::PipelineStageFlagBits2::eComputeShader);
+
+  commandBuffer.bindDescriptorSets(
+      vk::PipelineBindPoint::eCompute, MSplatPipelineLayout, 1,
+      {MSplatDescriptorSets[MRenderState * MSwapChainImages.size() +
+                            imageIndex]},
+      {});
+
+  // Clear the image with 16x16 work-groups
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             MSplatClearPipeline);
+  commandBuffer.dispatch((MSwapChainExtent.width + 15) / 16,
+                         (MSwapChainExtent.height + 15) / 16, 1);
+  memoryBarrier(commandBuffer, vk::PipelineStageFlagBits2::eComputeShader,
+                vk::AccessFlagBits2::eShaderStorageWrite,
+                vk::PipelineStageFlagBits2::eComputeShader,
+                vk::AccessFlagBits2::eShaderStorageWrite);
+
+  // Splat each of the particles active in the state
+  uint32_t particleCount = MSimulationStates[MRenderState].particleCount;
+  ComputePushConstants pushConstants{.particleCount = particleCount};
+  commandBuffer.pushConstants<ComputePushConstants>(
+      MSplatPipelineLayout, vk::ShaderStageFlagBits::eCompute, 0,
+      pushConstants);
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, MSplatPipeline);
+  commandBuffer.dispatch(
+      (particleCount + SComputeWorkItems - 1) / SComputeWorkItems, 1, 1);
+
+  if (MTimestampPeriod > 0.0f) {
+    commandBuffer.writeTimestamp2(vk::PipelineStageFlagBits2::eComputeShader,
+                                  MGraphicsQueryPool, MCurrentFrame * 2 + 1);
+  }
+
+  // Transition straight from general to present src layout
+  transitionImageLayout(commandBuffer, MSwapChainImages[imageIndex],
+                        vk::ImageLayout::eGeneral,
+                        vk::ImageLayout::ePresentSrcKHR,
+                        vk::AccessFlagBits2::eShaderStorageWrite, {},
+                        vk::PipelineStageFlagBits2::eComputeShader,
+                        vk::PipelineStageFlagBits2::eBottomOfPipe);
+}
+
+void vkParticle::recordComputeCommandBuffer(uint32_t inState,
+                                            uint32_t outState,
+                                            uint32_t particleCount) {
+  vk::raii::CommandBuffer &commandBuffer = MComputeCommandBuffers[outState];
+  commandBuffer.reset();
   // Don't need to set one-time-submit, simultanteous-ues, or render-pass flags
-  MComputeCommandBuffers[MCurrentFrame].begin({});
-  // Bind command-buffer to compute pipeline
-  MComputeCommandBuffers[MCurrentFrame].bindPipeline(
-      vk::PipelineBindPoint::eCompute, MComputePipeline);
-  // Bind to descriptor sets used by compute shader
-  MComputeCommandBuffers[MCurrentFrame].bindDescriptorSets(
+  commandBuffer.begin({});
+  // Time the step so that the particle budget can account for compute cost
+  if (MTimestampPeriod > 0.0f) {
+    commandBuffer.resetQueryPool(MComputeQueryPool, outState * 2, 2);
+    commandBuffer.writeTimestamp2(vk::PipelineStageFlagBits2::eTopOfPipe,
+                                  MComputeQueryPool, outState * 2);
+  }
+  // Bind to descriptor sets used by compute shader, which all the compute
+  // pipelines share the layout of.
+  commandBuffer.bindDescriptorSets(
+      vk::PipelineBindPoint::eCompute, MComputePipelineLayout, 0,
+      {MComputeDescriptorSets[inState * SSimulationStateCount + outState]},
+      {});
+  // Particles in newly committed sparse memory start from their initial
+  // state, in every state buffer so that any of them can be read next.
+  if (MUploadedParticles < MCommittedParticles) {
+    vk::BufferCopy region(sizeof(Particle) * MUploadedParticles,
+                          sizeof(Particle) * MUploadedParticles,
+                          sizeof(Particle) *
+                              (MCommittedParticles - MUploadedParticles));
+    for (vk::raii::Buffer &buffer : MShaderStorageBuffers) {
+      commandBuffer.copyBuffer(*MInitialParticleBuffer, *buffer, region);
+    }
+    memoryBarrier(commandBuffer, vk::PipelineStageFlagBits2::eTransfer,
+                  vk::AccessFlagBits2::eTransferWrite,
+                  vk::PipelineStageFlagBits2::eComputeShader,
+                  vk::AccessFlagBits2::eShaderStorageRead |
+                      vk::AccessFlagBits2::eShaderStorageWrite);
+    MUploadedParticles = MCommittedParticles;
+  }
+  if (MOptions.spatialQueries) {
+    recordSpatialQueryCommands(commandBuffer, inState, outState,
+                               particleCount);
+  }
+  switch (MOptions.kernel) {
+  case ComputeKernel::Euler:
+    // Plasma, fluid and cluster modes replace the Euler step with their own
+    // stages.
+    if (usesPlasma()) {
+      recordPlasmaCommands(commandBuffer, outState, particleCount);
+      break;
+    }
+    if (MOptions.mode == SimulationMode::Fluid) {
+      recordFluidCommands(commandBuffer, outState, particleCount);
+      break;
+    }
+    if (MOptions.mode == SimulationMode::Clusters) {
+      // A work-group per block of whole clusters
+      commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                                 MShapeMatchPipeline);
+      commandBuffer.dispatch(
+          (particleCount + SClusterBlockSize - 1) / SClusterBlockSize, 1, 1);
+      break;
+    }
+    [[fallthrough]];
+  case ComputeKernel::MultiStep:
+  case ComputeKernel::Half:
+    // Bind command-buffer to compute pipeline
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                               MComputePipeline);
+    // The 1D compute shader uses SCopmuteWorkItems work-group dispatch, set
+    // via specialization constants. So enough work-groups are dispatched to
+    // cover the active particles, with any remainder exiting early in the
+    // shader.
+    commandBuffer.dispatch(
+        (particleCount + SComputeWorkItems - 1) / SComputeWorkItems, 1, 1);
+    break;
+  case ComputeKernel::MultiRate:
+    recordMultiRateCommands(commandBuffer, particleCount);
+    break;
+  case ComputeKernel::Persistent:
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                               MComputePipeline);
+    recordScheduledDispatch(commandBuffer, particleCount, Schedule::Queue);
+    break;
+  case ComputeKernel::Collide:
+    if (MOptions.neighbourLists) {
+      recordNeighbourListCommands(commandBuffer, inState, outState,
+                                  particleCount);
+      break;
+    }
+    recordGridCommands(commandBuffer, inState, outState, particleCount);
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                               MComputePipeline);
+    recordScheduledDispatch(commandBuffer, particleCount, MOptions.schedule);
+    break;
+  case ComputeKernel::Fmm:
+    recordFmmCommands(commandBuffer, inState, outState, particleCount);
+    break;
+  case ComputeKernel::Fused:
+    // Pipeline for the modules enabled when the step is recorded
+    commandBuffer.bindPipeline(
+        vk::PipelineBindPoint::eCompute,
+        getFusedPipeline(MForceModules.load(std::memory_order_relaxed)));
+    commandBuffer.dispatch(
+        (particleCount + SComputeWorkItems - 1) / SComputeWorkItems, 1, 1);
+    break;
+  }
+  if (MOptions.injection) {
+    recordInjectCommands(commandBuffer);
+  }
+  // Pack the state just written into the stream drawn by the graphics
+  // pipeline, timed as part of the step as it scales with the particles.
+  if (usesRenderStream()) {
+    memoryBarrier(commandBuffer, vk::PipelineStageFlagBits2::eComputeShader,
+                  vk::AccessFlagBits2::eShaderStorageWrite,
+                  vk::PipelineStageFlagBits2::eComputeShader,
+                  vk::AccessFlagBits2::eShaderStorageRead);
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                               MRenderStreamPipeline);
+    commandBuffer.dispatch(
+        (particleCount + SComputeWorkItems - 1) / SComputeWorkItems, 1, 1);
+  }
+  if (MTimestampPeriod > 0.0f) {
+    commandBuffer.writeTimestamp2(vk::PipelineStageFlagBits2::eComputeShader,
+                                  MComputeQueryPool, outState * 2 + 1);
+  }
+
+  // Measured after the end timestamp, so as not to count towards step time
+  if (MOptions.kernel == ComputeKernel::Half && MOptions.stats) {
+    recordPrecisionErrorCommands(commandBuffer, particleCount);
+  }
+  MAnalyticsRecorded = false;
+  if (!MOptions.analyticsFile.empty() &&
+      MAnalyticsStep++ % MOptions.analyticsInterval == 0) {
+    recordAnalyticsCommands(commandBuffer, inState, outState, particleCount);
+    MAnalyticsRecorded = true;
+  }
+  commandBuffer.end();
+}
+
+void vkParticle::recordMultiRateCommands(vk::raii::CommandBuffer &commandBuffer,
+                                         uint32_t particleCount) {
+  // Bins are appended to with atomics, so reset the counters to zero first.
+  commandBuffer.fillBuffer(MMultiRateCountBuffer, 0, vk::WholeSize, 0);
+  memoryBarrier(commandBuffer, vk::PipelineStageFlagBits2::eTransfer,
+                vk::AccessFlagBits2::eTransferWrite,
+                vk::PipelineStageFlagBits2::eComputeShader,
+                vk::AccessFlagBits2::eShaderStorageRead |
+                    vk::AccessFlagBits2::eShaderStorageWrite);
+
+  // Copy every particle to the output state, and append its index to the
+  // compacted list of the bin for the timestep it requires.
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             MMultiRateBinPipeline);
+  commandBuffer.dispatch(
+      (particleCount + SComputeWorkItems - 1) / SComputeWorkItems, 1, 1);
+  memoryBarrier(commandBuffer, vk::PipelineStageFlagBits2::eComputeShader,
+                vk::AccessFlagBits2::eShaderStorageWrite,
+                vk::PipelineStageFlagBits2::eComputeShader,
+                vk::AccessFlagBits2::eShaderStorageRead |
+                    vk::AccessFlagBits2::eShaderStorageWrite);
+
+  // Single invocation turns the bin counts into indirect dispatch sizes.
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             MMultiRateArgsPipeline);
+  commandBuffer.dispatch(1, 1, 1);
+  memoryBarrier(commandBuffer, vk::PipelineStageFlagBits2::eComputeShader,
+                vk::AccessFlagBits2::eShaderStorageWrite,
+                vk::PipelineStageFlagBits2::eDrawIndirect |
+                    vk::PipelineStageFlagBits2::eComputeShader,
+                vk::AccessFlagBits2::eIndirectCommandRead |
+                    vk::AccessFlagBits2::eShaderStorageRead);
+
+  // Bin `k` advances by `deltaTime / 2^k`, so is due every `2^(L-1-k)`
+  // sub-steps of the smallest timestep. Bins are disjoint so those due on the
+  // same sub-step don't need a barrier between them, and each particle is
+  // only updated as often as its velocity requires.
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             MMultiRateStepPipeline);
+  constexpr uint32_t SubSteps = 1u << (SMultiRateLevels - 1);
+  for (uint32_t subStep = 0; subStep < SubSteps; subStep++) {
+    for (uint32_t level = 0; level < SMultiRateLevels; level++) {
+      if (subStep % (SubSteps >> level) != 0) {
+        continue;
+      }
+      ComputePushConstants pushConstants{.level = level};
+      commandBuffer.pushConstants<ComputePushConstants>(
+          MComputePipelineLayout, vk::ShaderStageFlagBits::eCompute, 0,
+          pushConstants);
+      commandBuffer.dispatchIndirect(
+          MMultiRateArgsBuffer, level * sizeof(vk::DispatchIndirectCommand));
+    }
+    memoryBarrier(commandBuffer, vk::PipelineStageFlagBits2::eComputeShader,
+                  vk::AccessFlagBits2::eShaderStorageWrite,
+                  vk::PipelineStageFlagBits2::eComputeShader,
+                  vk::AccessFlagBits2::eShaderStorageRead |
+                      vk::AccessFlagBits2::eShaderStorageWrite);
+  }
+}
+
+void vkParticle::recordGridCommands(vk::raii::CommandBuffer &commandBuffer,
+                                    uint32_t inState, uint32_t outState,
+                                    uint32_t particleCount) {
+  // The previous sorted order can only be repaired if it holds the same
+  // particles. Churn was counted by the last compare, which has completed.
+  bool compare = MOptions.gridChurnThreshold > 0 &&
+                 particleCount == MGridSortedCount;
+  bool incremental =
+      compare && uint64_t{*MGridChurnMapped} * 100 <=
+                     uint64_t{MOptions.gridChurnThreshold} * particleCount;
+  if (MOptions.stats && ++MGridBuildCount % SGridReferenceInterval == 0) {
+    incremental = false;
+  }
+
+  // Full builds are timed without the compare, which they only run to
+  // measure churn for the next step.
+  bool timed = MTimestampPeriod > 0.0f;
+  if (timed) {
+    commandBuffer.resetQueryPool(MGridQueryPool, outState * 2, 2);
+  }
+  if (timed && incremental) {
+    commandBuffer.writeTimestamp2(vk::PipelineStageFlagBits2::eTopOfPipe,
+                                  MGridQueryPool, outState * 2);
+  }
+
+  if (compare) {
+    // Arrivals are counted into the cell counts
+    commandBuffer.fillBuffer(MGridCellCountBuffer, 0, vk::WholeSize, 0);
+    commandBuffer.fillBuffer(MGridDepartureCountBuffer, 0, vk::WholeSize, 0);
+    commandBuffer.fillBuffer(MGridChurnBuffer, 0, vk::WholeSize, 0);
+    memoryBarrier(commandBuffer, vk::PipelineStageFlagBits2::eTransfer,
+                  vk::AccessFlagBits2::eTransferWrite,
+                  vk::PipelineStageFlagBits2::eComputeShader,
+                  vk::AccessFlagBits2::eShaderStorageRead |
+                      vk::AccessFlagBits2::eShaderStorageWrite);
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                               MGridComparePipeline);
+    commandBuffer.dispatch(
+        (particleCount + SComputeWorkItems - 1) / SComputeWorkItems, 1, 1);
+    memoryBarrier(commandBuffer, vk::PipelineStageFlagBits2::eComputeShader,
+                  vk::AccessFlagBits2::eShaderStorageWrite,
+                  vk::PipelineStageFlagBits2::eComputeShader |
+                      vk::PipelineStageFlagBits2::eTransfer |
+                      vk::PipelineStageFlagBits2::eHost,
+                  vk::AccessFlagBits2::eShaderStorageRead |
+                      vk::AccessFlagBits2::eShaderStorageWrite |
+                      vk::AccessFlagBits2::eTransferWrite |
+                      vk::AccessFlagBits2::eHostRead);
+  }
+
+  if (timed && !incremental) {
+    commandBuffer.writeTimestamp2(vk::PipelineStageFlagBits2::eComputeShader,
+                                  MGridQueryPool, outState * 2);
+  }
+  if (incremental) {
+    recordGridMergeCommands(commandBuffer, inState, outState, particleCount);
+  } else {
+    recordGridRebuildCommands(commandBuffer, inState, outState,
+                              particleCount);
+  }
+  if (timed) {
+    commandBuffer.writeTimestamp2(vk::PipelineStageFlagBits2::eComputeShader,
+                                  MGridQueryPool, outState * 2 + 1);
+  }
+
+  MGridSortedCount = particleCount;
+  MGridBuild = incremental ? GridBuild::Incremental : GridBuild::Full;
+  MGridCompared = compare;
+}
+
+void vkParticle::recordGridRebuildCommands(
+    vk::raii::CommandBuffer &commandBuffer, uint32_t inState,
+    uint32_t outState, uint32_t particleCount) {
+  uint32_t workGroups =
+      (particleCount + SComputeWorkItems - 1) / SComputeWorkItems;
+  // Counts are accumulated with atomics, so start from zero
+  commandBuffer.fillBuffer(MGridCellCountBuffer, 0, vk::WholeSize, 0);
+  memoryBarrier(commandBuffer, vk::PipelineStageFlagBits2::eTransfer,
+                vk::AccessFlagBits2::eTransferWrite,
+                vk::PipelineStageFlagBits2::eComputeShader,
+                vk::AccessFlagBits2::eShaderStorageRead |
+                    vk::AccessFlagBits2::eShaderStorageWrite);
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             MGridCountPipeline);
+  commandBuffer.dispatch(workGroups, 1, 1);
+  memoryBarrier(commandBuffer, vk::PipelineStageFlagBits2::eComputeShader,
+                vk::AccessFlagBits2::eShaderStorageWrite,
+                vk::PipelineStageFlagBits2::eComputeShader |
+                    vk::PipelineStageFlagBits2::eTransfer,
+                vk::AccessFlagBits2::eShaderStorageRead |
+                    vk::AccessFlagBits2::eTransferWrite);
+
+  // Start of each cell in sorted order
+  recordExclusiveScan(commandBuffer, MGridCellCountBuffer,
+                      MGridCellStartBuffer, MGridScratchBuffer,
+                      SGridCellCount + 1);
+
+  // Once the scan has read the counts, reset them to use as cursors
+  memoryBarrier(commandBuffer, vk::PipelineStageFlagBits2::eComputeShader,
+                vk::AccessFlagBits2::eShaderStorageRead |
+                    vk::AccessFlagBits2::eShaderStorageWrite,
+                vk::PipelineStageFlagBits2::eTransfer,
+                vk::AccessFlagBits2::eTransferWrite);
+  commandBuffer.fillBuffer(MGridCellCountBuffer, 0, vk::WholeSize, 0);
+  memoryBarrier(commandBuffer,
+                vk::PipelineStageFlagBits2::eTransfer |
+                    vk::PipelineStageFlagBits2::eComputeShader,
+                vk::AccessFlagBits2::eTransferWrite |
+                    vk::AccessFlagBits2::eShaderStorageWrite,
+                vk::PipelineStageFlagBits2::eComputeShader,
+                vk::AccessFlagBits2::eShaderStorageRead |
+                    vk::AccessFlagBits2::eShaderStorageWrite);
+
+  // The scan bound its own pipeline layout, so bind the step's set again
+  commandBuffer.bindDescriptorSets(
       vk::PipelineBindPoint::eCompute, MComputePipelineLayout, 0,
-      {MComputeDescriptorSets[MCurrentFrame]}, {});
-  // The 1D compute shader uses SCopmuteWorkItems work-group dispatch, set via
-  // specialization constants. So total number of invocations at the moment
-  // is "SComputeWorkGroups * SComputeWorkItems"
-  MComputeCommandBuffers[MCurrentFrame].dispatch(SComputeWorkGroups, 1, 1);
-  MComputeCommandBuffers[MCurrentFrame].end();
+      {MComputeDescriptorSets[inState * SSimulationStateCount + outState]},
+      {});
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             MGridScatterPipeline);
+  commandBuffer.dispatch(workGroups, 1, 1);
+  memoryBarrier(commandBuffer, vk::PipelineStageFlagBits2::eComputeShader,
+                vk::AccessFlagBits2::eShaderStorageWrite,
+                vk::PipelineStageFlagBits2::eComputeShader,
+                vk::AccessFlagBits2::eShaderStorageRead);
+}
+
+void vkParticle::recordGridMergeCommands(
+    vk::raii::CommandBuffer &commandBuffer, uint32_t inState,
+    uint32_t outState, uint32_t particleCount) {
+  // Scans share the scratch buffer, which each clears with a fill
+  auto scanBarrier = [&commandBuffer]() {
+    memoryBarrier(commandBuffer, vk::PipelineStageFlagBits2::eComputeShader,
+                  vk::AccessFlagBits2::eShaderStorageRead |
+                      vk::AccessFlagBits2::eShaderStorageWrite,
+                  vk::PipelineStageFlagBits2::eComputeShader |
+                      vk::PipelineStageFlagBits2::eTransfer,
+                  vk::AccessFlagBits2::eShaderStorageRead |
+                      vk::AccessFlagBits2::eTransferWrite);
+  };
+  // Slot of each stayed particle among the stayed particles, and the number
+  // of particles arriving in and departing from the cells before each cell.
+  recordExclusiveScan(commandBuffer, MGridStayFlagBuffer, MGridStayRankBuffer,
+                      MGridScratchBuffer, particleCount);
+  scanBarrier();
+  recordExclusiveScan(commandBuffer, MGridCellCountBuffer,
+                      MGridArrivalStartBuffer, MGridScratchBuffer,
+                      SGridCellCount + 1);
+  scanBarrier();
+  recordExclusiveScan(commandBuffer, MGridDepartureCountBuffer,
+                      MGridDepartureStartBuffer, MGridScratchBuffer,
+                      SGridCellCount + 1);
+  scanBarrier();
+
+  // The scans bound their own pipeline layout, so bind the step's set again
+  commandBuffer.bindDescriptorSets(
+      vk::PipelineBindPoint::eCompute, MComputePipelineLayout, 0,
+      {MComputeDescriptorSets[inState * SSimulationStateCount + outState]},
+      {});
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             MGridStartsPipeline);
+  commandBuffer.dispatch(
+      (SGridCellCount + 1 + SComputeWorkItems - 1) / SComputeWorkItems, 1, 1);
+  memoryBarrier(commandBuffer, vk::PipelineStageFlagBits2::eComputeShader,
+                vk::AccessFlagBits2::eShaderStorageWrite,
+                vk::PipelineStageFlagBits2::eComputeShader,
+                vk::AccessFlagBits2::eShaderStorageRead);
+
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             MGridMergePipeline);
+  commandBuffer.dispatch(
+      (particleCount + SComputeWorkItems - 1) / SComputeWorkItems, 1, 1);
+  memoryBarrier(commandBuffer, vk::PipelineStageFlagBits2::eComputeShader,
+                vk::AccessFlagBits2::eShaderStorageWrite,
+                vk::PipelineStageFlagBits2::eComputeShader,
+                vk::AccessFlagBits2::eShaderStorageRead);
+}
+
+void vkParticle::recordScheduledDispatch(
+    vk::raii::CommandBuffer &commandBuffer, uint32_t particleCount,
+    Schedule schedule) {
+  uint32_t workGroups =
+      (particleCount + SComputeWorkItems - 1) / SComputeWorkItems;
+  if (schedule == Schedule::Dispatch) {
+    commandBuffer.dispatch(workGroups, 1, 1);
+    return;
+  }
+
+  if (schedule == Schedule::Queue) {
+    // Work queue starts from the first particle each step
+    commandBuffer.fillBuffer(MWorkQueueBuffer, 0, vk::WholeSize, 0);
+    memoryBarrier(commandBuffer, vk::PipelineStageFlagBits2::eTransfer,
+                  vk::AccessFlagBits2::eTransferWrite,
+                  vk::PipelineStageFlagBits2::eComputeShader,
+                  vk::AccessFlagBits2::eShaderStorageRead |
+                      vk::AccessFlagBits2::eShaderStorageWrite);
+  }
+  // Rather than a work-group per block of particles, launch a fixed number
+  // of work-groups which loop over the particles. The shader derives the
+  // same count for its stride.
+  commandBuffer.dispatch(std::min(SPersistentWorkGroups, workGroups), 1, 1);
+}
+
+void vkParticle::recordNeighbourListCommands(
+    vk::raii::CommandBuffer &commandBuffer, uint32_t inState,
+    uint32_t outState, uint32_t particleCount) {
+  uint32_t workGroups =
+      (particleCount + SComputeWorkItems - 1) / SComputeWorkItems;
+  // The last step has completed, so its largest displacement can be read
+  // back to decide whether the lists are still valid. Particles activated
+  // since the last rebuild don't have a list yet.
+  MGridBuild = GridBuild::None;
+  constexpr float HalfSkin = SNeighbourSkin / 2.0f;
+  bool rebuild =
+      particleCount > MNeighbourListCount ||
+      std::bit_cast<float>(*MNeighbourMaxDisplacementMapped) >
+          HalfSkin * HalfSkin;
+  if (rebuild) {
+    recordGridCommands(commandBuffer, inState, outState, particleCount);
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                               MNeighbourBuildPipeline);
+    commandBuffer.dispatch(workGroups, 1, 1);
+    memoryBarrier(commandBuffer, vk::PipelineStageFlagBits2::eComputeShader,
+                  vk::AccessFlagBits2::eShaderStorageWrite,
+                  vk::PipelineStageFlagBits2::eComputeShader,
+                  vk::AccessFlagBits2::eShaderStorageRead);
+    MNeighbourListCount = particleCount;
+    MNeighbourRebuilds++;
+  }
+
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             MComputePipeline);
+  recordScheduledDispatch(commandBuffer, particleCount, MOptions.schedule);
+  memoryBarrier(commandBuffer, vk::PipelineStageFlagBits2::eComputeShader,
+                vk::AccessFlagBits2::eShaderStorageWrite,
+                vk::PipelineStageFlagBits2::eComputeShader |
+                    vk::PipelineStageFlagBits2::eTransfer,
+                vk::AccessFlagBits2::eShaderStorageRead |
+                    vk::AccessFlagBits2::eTransferWrite);
+
+  // Reduced on the GPU, so that only a single value is read back to decide
+  // whether the next step rebuilds.
+  recordReduce(commandBuffer, MNeighbourDisplacementBuffer,
+               MNeighbourMaxDisplacementBuffer, particleCount,
+               PrimitiveOp::Max);
+  if (rebuild) {
+    recordReduce(commandBuffer, MNeighbourCountBuffer, MNeighbourTotalBuffer,
+                 particleCount, PrimitiveOp::Sum);
+    recordReduce(commandBuffer, MNeighbourCountBuffer,
+                 MNeighbourMaxCountBuffer, particleCount, PrimitiveOp::Max);
+  }
+  memoryBarrier(commandBuffer, vk::PipelineStageFlagBits2::eComputeShader,
+                vk::AccessFlagBits2::eShaderStorageWrite,
+                vk::PipelineStageFlagBits2::eHost,
+                vk::AccessFlagBits2::eHostRead);
+}
+
+void vkParticle::recordPrecisionErrorCommands(
+    vk::raii::CommandBuffer &commandBuffer, uint32_t particleCount) {
+  // Error is the maximum over particles, so reset it to zero each step.
+  commandBuffer.fillBuffer(MPrecisionErrorBuffer, 0, vk::WholeSize, 0);
+  memoryBarrier(commandBuffer,
+                vk::PipelineStageFlagBits2::eTransfer |
+                    vk::PipelineStageFlagBits2::eComputeShader,
+                vk::AccessFlagBits2::eTransferWrite |
+                    vk::AccessFlagBits2::eShaderStorageWrite,
+                vk::PipelineStageFlagBits2::eComputeShader,
+                vk::AccessFlagBits2::eShaderStorageRead |
+                    vk::AccessFlagBits2::eShaderStorageWrite);
+
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             MPrecisionErrorPipeline);
+  commandBuffer.dispatch(
+      (particleCount + SComputeWorkItems - 1) / SComputeWorkItems, 1, 1);
+
+  // Make the error visible to the host once the step has completed.
+  memoryBarrier(commandBuffer, vk::PipelineStageFlagBits2::eComputeShader,
+                vk::AccessFlagBits2::eShaderStorageWrite,
+                vk::PipelineStageFlagBits2::eHost,
+                vk::AccessFlagBits2::eHostRead);
 }
@@ -7,47 +7,508 @@ import vulkan_hpp;
 #include <GLFW/glfw3.h>
 
 #include <array>
+#include <atomic>
+#include <ctime>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <future>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
 
-/// @brief Class used to interface with shader device code
-struct Particle {
+/// @brief Class used to interface with shader device code. Aligned to 16
+/// bytes, like the shader struct is by its float4 member.
+struct alignas(16) Particle {
   glm::vec2 position;
   glm::vec2 velocity;
   glm::vec4 color;
+  /// @brief Charge and mass of the particle in `SimulationMode::Plasma` and
+  /// `SimulationMode::MagnetisedPlasma`, mass also in
+  /// `SimulationMode::Brownian` and `SimulationMode::Clusters`.
+  float charge = 0.0f;
+  float mass = 1.0f;
+};
+
+/// @brief Compact copy of the parts of a `Particle` drawn by the graphics
+/// pipeline, written by `compRenderStream` at the end of each step so that
+/// the vertex stage doesn't fetch the full simulation state.
+struct RenderVertex {
+  /// @brief Half of the clip space position as two 16-bit signed normalised
+  /// values, so that positions just outside the window still clip.
+  uint32_t position;
+  /// @brief Color as four 8-bit unsigned normalised values.
+  uint32_t color;
 
   // Tells the runtime what stride to use for vertex data
   static vk::VertexInputBindingDescription getBindingDescription() {
-    return {0, sizeof(Particle), vk::VertexInputRate::eVertex};
+    return {0, sizeof(RenderVertex), vk::VertexInputRate::eVertex};
   }
 
   static std::array<vk::VertexInputAttributeDescription, 2>
   getAttributeDescriptions() {
     return {
         // In Vertex shader input, we have a float2 position struct attribute
-        // followed by a float4 color attribute.
-        vk::VertexInputAttributeDescription(0, 0, vk::Format::eR32G32Sfloat,
-                                            offsetof(Particle, position)),
-        vk::VertexInputAttributeDescription(
-            1, 0, vk::Format::eR32G32B32A32Sfloat, offsetof(Particle, color))};
+        // followed by a float4 color attribute, both unpacked by the vertex
+        // fetch from their normalised formats.
+        vk::VertexInputAttributeDescription(0, 0, vk::Format::eR16G16Snorm,
+                                            offsetof(RenderVertex, position)),
+        vk::VertexInputAttributeDescription(1, 0, vk::Format::eR8G8B8A8Unorm,
+                                            offsetof(RenderVertex, color))};
   }
 };
 
 /// @brief uniform buffer used in compute shader
 struct UniformBufferObject {
   float deltaTime = 1.0f;
+  uint32_t particleCount = 0;
+  /// @brief Strength of the force pulling particles to the window centre.
+  float forceFieldStrength = 0.0f;
+  /// @brief Number of time steps `compMultiStep` advances particles by.
+  uint32_t stepCount = 1;
+  /// @brief Scale of the charge each particle deposits in the plasma modes.
+  float plasmaChargeScale = 0.0f;
+  /// @brief Strength of the uniform magnetic field out of the window in
+  /// `SimulationMode::MagnetisedPlasma`.
+  float magneticField = 0.0f;
+  /// @brief Order of the expansions of `ComputeKernel::Fmm`.
+  uint32_t fmmOrder = 0;
+  /// @brief Gravitational strength of each particle in `ComputeKernel::Fmm`.
+  float fmmStrength = 0.0f;
+  /// @brief Rate velocities relax at in `SimulationMode::Brownian`, zero in
+  /// other modes.
+  float brownianDamping = 0.0f;
+  /// @brief Thermal energy of `SimulationMode::Brownian`.
+  float brownianTemperature = 0.0f;
+  /// @brief Key of the random numbers drawn by `SimulationMode::Brownian`.
+  uint32_t seed = 0;
+  /// @brief Index of the step, which random numbers are drawn for.
+  uint32_t stepIndex = 0;
+  /// @brief Slot of the spawn ring holding the first particle injected by
+  /// the step.
+  uint32_t spawnFirst = 0;
+  /// @brief Number of particles injected by the step.
+  uint32_t spawnCount = 0;
+  /// @brief First of the particles replaced by the injected particles.
+  uint32_t spawnTarget = 0;
+};
+
+/// @brief Push constants used by compute kernels for arguments which vary
+/// between dispatches.
+struct ComputePushConstants {
+  /// @brief Timestep level of the particles updated by a multi-rate dispatch,
+  /// or quadtree level of a fast multipole pass.
+  uint32_t level = 0;
+  /// @brief Number of particles splatted by the compute renderer, or sampled
+  /// by the fast multipole reference.
+  uint32_t particleCount = 0;
+  /// @brief Number of spatial queries answered by a dispatch.
+  uint32_t queryCount = 0;
+  /// @brief Colour of the red-black nodes updated by a plasma solve sweep,
+  /// copy of the pressure read by a fluid Jacobi iteration, or pass of the
+  /// surface filter.
+  uint32_t sweep = 0;
+};
+
+/// @brief Push constants of the parallel primitives in primitives.slang.
+struct PrimitivePushConstants {
+  /// @brief Number of elements operated on.
+  uint32_t count = 0;
+  /// @brief `PrimitiveOp` of a reduction.
+  uint32_t op = 0;
+  /// @brief Radix sort pass being scattered.
+  uint32_t radixPass = 0;
+  /// @brief Number of 8-bit radix sort passes.
+  uint32_t radixPassCount = 0;
+};
+
+/// @brief Operation combining elements in a parallel reduction.
+enum class PrimitiveOp : uint32_t {
+  Sum,
+  /// Also orders non-negative floats reduced as their bits.
+  Max,
+};
+
+/// @brief Compute kernel variant used to advance the particles each step.
+enum class ComputeKernel {
+  /// Every particle advanced by the full time step in `compMain`.
+  Euler,
+  /// Particles binned by required timestep, with each bin advanced only on
+  /// the sub-steps it is due.
+  MultiRate,
+  /// Every particle advanced by `Options::stepCount` time steps, held in
+  /// registers between steps and only written out at the end.
+  MultiStep,
+  /// Every particle advanced by the full time step in `compMainHalf`, which
+  /// does its arithmetic in half precision.
+  Half,
+  /// Just enough work-groups to fill the GPU are launched, which pull chunks
+  /// of particles from an atomic work queue until none are left.
+  Persistent,
+  /// Particles repel their neighbours within a short radius, found with a
+  /// two level grid rebuilt each step.
+  Collide,
+  /// Every particle advanced in `compFused` by the sum of the enabled
+  /// `ForceModule` accelerations, with a pipeline specialized for each
+  /// combination of modules so that a particle is read and written once.
+  Fused,
+  /// Every particle attracts every other with 2D gravity, evaluated in
+  /// linear time by a fast multipole method over the grid as a quadtree.
+  Fmm,
+};
+
+/// @brief How the invocations of `ComputeKernel::Collide` are assigned
+/// particles, to compare under particles of varying cost.
+enum class Schedule {
+  /// An invocation per particle.
+  Dispatch,
+  /// `vkParticle::SPersistentWorkGroups` work-groups, each looping over
+  /// particles a whole dispatch apart.
+  GridStride,
+  /// `vkParticle::SPersistentWorkGroups` work-groups, which pull chunks of
+  /// particles from an atomic work queue until none are left.
+  Queue,
+};
+
+/// @brief Force modules composed by `ComputeKernel::Fused`, as a bit mask.
+/// Must match the `IForce` implementations in shader.
+enum class ForceModule : uint32_t {
+  /// Harmonic force pulling particles towards the window centre.
+  Field = 1 << 0,
+  /// Constant acceleration towards the bottom of the window.
+  Gravity = 1 << 1,
+  /// Linear drag slowing particles down.
+  Drag = 1 << 2,
+};
+
+/// @brief Physics model used to update the particles.
+enum class SimulationMode {
+  /// Particles move in straight lines, reflecting off the window border.
+  Ballistic,
+  /// Particles are also accelerated towards the window centre.
+  ForceField,
+  /// Electrons and ions interacting through their electric field, solved
+  /// particle-in-cell on a grid, and advanced by a Boris pusher rather than
+  /// Euler steps.
+  Plasma,
+  /// `Plasma` in a uniform magnetic field out of the window.
+  MagnetisedPlasma,
+  /// Incompressible fluid under gravity, with velocity carried by the
+  /// particles and made divergence free on a grid, blending FLIP and PIC
+  /// velocity updates.
+  Fluid,
+  /// Langevin dynamics, where particles are slowed by drag and kicked by
+  /// thermal noise drawn from a counter-based random number generator.
+  Brownian,
+  /// Rigid and soft clusters of particles falling under gravity, held to
+  /// their rest shape by shape matching.
+  Clusters,
+};
+
+/// @brief Initial distribution of particle positions, to compare performance
+/// of spatial structures under different densities.
+enum class Distribution {
+  /// Disc in the middle of the window, moving outwards.
+  Disc,
+  /// Spread evenly over the window.
+  Uniform,
+  /// Tight clusters around a few random centres.
+  Clustered,
+  /// Every particle within a single fine grid cell, a disc around the
+  /// centre of the cell above and right of the window centre.
+  Point,
+};
+
+/// @brief How particles are drawn to the swapchain image.
+enum class Renderer {
+  /// Particles drawn as points by the graphics pipeline.
+  Graphics,
+  /// Particles splatted by a compute shader writing directly to a storage
+  /// capable swapchain image, skipping the graphics pipeline.
+  Compute,
+  /// Particles drawn as one smooth fluid surface, by splatting their
+  /// thickness into a low resolution target, smoothing it with a bilateral
+  /// filter, and shading it with the graphics pipeline.
+  Surface,
+};
+
+/// @brief Application options parsed from the command-line.
+struct Options {
+  ComputeKernel kernel = ComputeKernel::Euler;
+  SimulationMode mode = SimulationMode::Ballistic;
+  Renderer renderer = Renderer::Graphics;
+  Distribution distribution = Distribution::Disc;
+  /// @brief Time steps advanced per simulation step by
+  /// `ComputeKernel::MultiStep`.
+  uint32_t stepCount = 8;
+  /// @brief Mask of `ForceModule` initially enabled in
+  /// `ComputeKernel::Fused`.
+  uint32_t forceModules = static_cast<uint32_t>(ForceModule::Field);
+  /// @brief Reuse Verlet neighbour lists across steps in
+  /// `ComputeKernel::Collide`, rather than querying the grid every step.
+  bool neighbourLists = false;
+  /// @brief Assignment of particles to invocations by
+  /// `ComputeKernel::Collide`.
+  Schedule schedule = Schedule::Dispatch;
+  /// @brief Percentage of particles changing cell between steps up to which
+  /// `ComputeKernel::Collide` repairs the previous sorted order of its grid,
+  /// rather than sorting from scratch. Zero to always sort from scratch.
+  uint32_t gridChurnThreshold = 0;
+  /// @brief Answer `SpatialQuery` batches submitted with
+  /// `vkParticle::submitSpatialQueries()`, and query the particles around
+  /// the cursor when clicked.
+  bool spatialQueries = false;
+  /// @brief Write particles appended with `vkParticle::injectParticles()`
+  /// into the simulation, and spawn a burst of them at the cursor on right
+  /// click.
+  bool injection = false;
+  /// @brief File holding the initial state of every particle, as a raw array
+  /// of `vkParticle::SMaxParticleCount` `Particle`, which is memory mapped
+  /// rather than read. Empty to generate the initial state from
+  /// `distribution`.
+  std::string initialStateFile;
+  /// @brief CSV file to stream the speed histogram and radial distribution
+  /// function measured on the GPU to, empty to not measure them.
+  std::string analyticsFile;
+  /// @brief Simulation steps between measurements written to
+  /// `analyticsFile`.
+  uint32_t analyticsInterval = 60;
+  /// @brief Print simulation statistics every second, including the error of
+  /// reduced precision kernels against an fp32 reference.
+  bool stats = false;
+  /// @brief Check the parallel primitives against the standard library and
+  /// print their throughput, then exit rather than simulating.
+  bool benchmarkPrimitives = false;
+  /// @brief Order of the multipole and local expansions of
+  /// `ComputeKernel::Fmm`, at most `vkParticle::SFmmMaxOrder`.
+  uint32_t fmmOrder = 8;
+  /// @brief Print the throughput and error against all-pairs summation of
+  /// `ComputeKernel::Fmm` for a range of orders, then exit rather than
+  /// simulating.
+  bool benchmarkFmm = false;
+  /// @brief Seed of the initial particle state and the noise of
+  /// `SimulationMode::Brownian`, which also advance by a fixed time step with
+  /// the maximum number of particles so that runs are reproducible. Seeded
+  /// from the clock when unset.
+  std::optional<uint32_t> seed;
+};
+
+/// @brief Controller which adjusts the number of active particles between a
+/// minimum and maximum to hold a target frame time, based on measured GPU
+/// compute and render times.
+struct ParticleBudget {
+  /// @param[in] minCount Fewest particles to simulate.
+  /// @param[in] maxCount Most particles to simulate, the allocated capacity.
+  /// @param[in] granularity Particle count is kept a multiple of this.
+  /// @param[in] targetFrameTime Frame time to hold in milliseconds.
+  ParticleBudget(uint32_t minCount, uint32_t maxCount, uint32_t granularity,
+                 double targetFrameTime);
+
+  /// @brief Feeds the latest GPU timings into the controller.
+  /// @param[in] computeTime Milliseconds taken by the last simulation step.
+  /// @param[in] renderTime Milliseconds taken by the last rendered frame.
+  /// @returns Number of particles to simulate in the next step.
+  uint32_t update(double computeTime, double renderTime);
+
+  /// @returns Number of particles to simulate in the next step.
+  uint32_t count() const { return MCount; }
+
+private:
+  uint32_t MMinCount;
+  uint32_t MMaxCount;
+  uint32_t MGranularity;
+  double MTargetFrameTime;
+  /// @brief Smoothed compute plus render time in milliseconds.
+  double MFrameTime = 0.0;
+  uint32_t MCount;
+};
+
+/// @brief State of one of the particle state buffers shared between the
+/// simulation thread and the renderer.
+struct SimulationState {
+  /// @brief Number of active particles written by the simulation step.
+  uint32_t particleCount = 0;
+  /// @brief Graphics timeline value signalled once the last draw reading from
+  /// the state has completed.
+  uint64_t graphicsValue = 0;
+};
+
+/// @brief Kind of `SpatialQuery`.
+enum class SpatialQueryType : uint32_t {
+  /// Particles within a radius of a point.
+  Radius,
+  /// Particles within an axis aligned box.
+  Range,
+  /// Nearest particles to a probe point.
+  Nearest,
+};
+
+/// @brief Query of the live particle set answered on the GPU, laid out to
+/// match `SpatialQuery` in shader. Positions are in clip space.
+struct SpatialQuery {
+  SpatialQueryType type = SpatialQueryType::Radius;
+  /// @brief Number of particles to find with `SpatialQueryType::Nearest`,
+  /// at most `vkParticle::SSpatialQueryCapacity`.
+  uint32_t count = 0;
+  /// @brief Centre of a radius query, minimum corner of a range query, or
+  /// probe of a nearest query.
+  glm::vec2 point{0.0f};
+  /// @brief Radius of a radius query in x, or maximum corner of a range
+  /// query.
+  glm::vec2 extent{0.0f};
+};
+
+/// @brief Contiguous range of particles forming a shape matching cluster,
+/// laid out to match `ClusterRange` in shader.
+struct ClusterRange {
+  uint32_t start = 0;
+  /// @brief Power of two, with `start` a multiple of it, so that clusters
+  /// never straddle a block of `vkParticle::SClusterBlockSize` particles.
+  uint32_t count = 0;
+  /// @brief Fraction of the way to its goal position each particle is pulled
+  /// every step, one for a rigid cluster.
+  float stiffness = 1.0f;
+  float padding = 0.0f;
+};
+
+/// @brief Cluster of a particle and its rest position, laid out to match
+/// `ClusterMember` in shader.
+struct ClusterMember {
+  /// @brief Offset from the cluster's rest centre of mass.
+  glm::vec2 restOffset{0.0f};
+  uint32_t cluster = 0;
+  uint32_t padding = 0;
+};
+
+/// @brief Particle injected from the host with
+/// `vkParticle::injectParticles()`, laid out to match `SpawnRecord` in
+/// shader. Positions are in clip space.
+struct alignas(16) SpawnRecord {
+  glm::vec2 position{0.0f};
+  glm::vec2 velocity{0.0f};
+  glm::vec4 color{1.0f};
+};
+
+/// @brief Answer to a `SpatialQuery`.
+struct SpatialQueryResult {
+  /// @brief Indices of the particles found, nearest first for
+  /// `SpatialQueryType::Nearest`. Truncated to
+  /// `vkParticle::SSpatialQueryCapacity` particles.
+  std::vector<uint32_t> particles;
+  /// @brief Number of particles matching the query, which may be more than
+  /// were returned.
+  uint32_t matched = 0;
+};
+
+/// @brief Batch of spatial queries waiting to be answered.
+struct SpatialQueryBatch {
+  std::vector<SpatialQuery> queries;
+  /// @brief Fulfilled with the result of each query once answered.
+  std::promise<std::vector<SpatialQueryResult>> promise;
+};
+
+/// @brief How a simulation step built the grid of `ComputeKernel::Collide`.
+enum class GridBuild {
+  /// Not built, as the neighbour lists were reused.
+  None,
+  /// Counting sorted from scratch.
+  Full,
+  /// Previous sorted order repaired by moving the particles which changed
+  /// cell.
+  Incremental,
+};
+
+/// @brief Grid build statistics accumulated between statistics reports.
+struct GridStats {
+  uint32_t fullBuilds = 0;
+  /// @brief Total GPU milliseconds of the full builds.
+  double fullTime = 0.0;
+  uint32_t incrementalBuilds = 0;
+  /// @brief Total GPU milliseconds of the incremental builds.
+  double incrementalTime = 0.0;
+  /// @brief Particles which changed cell, out of the particles compared.
+  uint64_t churned = 0;
+  uint64_t compared = 0;
+};
+
+/// @brief Page aligned host memory, either anonymous or mapped from a file,
+/// unmapped when destroyed.
+struct HostMapping {
+  HostMapping() = default;
+  /// @brief Maps `size` bytes, from the start of `file` if not empty.
+  HostMapping(const std::string &file, size_t size);
+  HostMapping(HostMapping &&other) noexcept
+      : data(std::exchange(other.data, nullptr)),
+        size(std::exchange(other.size, 0)) {}
+  HostMapping &operator=(HostMapping &&other) noexcept {
+    std::swap(data, other.data);
+    std::swap(size, other.size);
+    return *this;
+  }
+  ~HostMapping();
+
+  void *data = nullptr;
+  size_t size = 0;
 };
 
 /// @brief Class holding RAII state of the application
 struct vkParticle {
+  /// @param[in] options Command-line options to run the application with.
+  explicit vkParticle(const Options &options) : MOptions(options) {}
+
   /// @brief User code entry-point, called by main.cpp
   void run();
 
   /// @brief Set by GLFW callback when window is resized.
   bool MFramebufferResized = false;
+  /// @brief Mask of `ForceModule` enabled in `ComputeKernel::Fused`, toggled
+  /// by GLFW key callback and read by the simulation thread.
+  std::atomic<uint32_t> MForceModules = 0;
+  /// @brief Clip space position of a click to query the particles around,
+  /// set by GLFW mouse button callback.
+  std::optional<glm::vec2> MCursorClick;
+  /// @brief Clip space position of a right click to spawn particles at, set
+  /// by GLFW mouse button callback.
+  std::optional<glm::vec2> MCursorSpawn;
+
+  /// @brief Submits a batch of spatial queries, answered on the GPU by the
+  /// next simulation step from the state it reads. May be called from any
+  /// thread once running with `Options::spatialQueries`.
+  /// @param[in] queries Queries to answer, at most `SMaxSpatialQueries`.
+  /// @returns Future of the result of each query, in order.
+  std::future<std::vector<SpatialQueryResult>>
+  submitSpatialQueries(std::vector<SpatialQuery> queries);
+
+  /// @brief Appends particles to the persistently mapped spawn ring, which
+  /// the next simulation step writes over the particles injected longest
+  /// ago. Lock-free, and may be called from any number of threads at once
+  /// when running with `Options::injection`.
+  /// @param[in] spawns Particles to inject.
+  /// @returns Whether the whole batch fit in the ring, otherwise nothing is
+  /// injected and the batch can be retried after the next step.
+  bool injectParticles(std::span<const SpawnRecord> spawns);
+
+  /// Most particles returned by a spatial query. Must match
+  /// `SpatialQueryCapacity` in shader.
+  static constexpr uint32_t SSpatialQueryCapacity = 64;
+  /// Most spatial queries answered by a simulation step.
+  static constexpr uint32_t SMaxSpatialQueries = 256;
+  /// Particles the spawn ring holds. Must match `SpawnRingCapacity` in
+  /// shader.
+  static constexpr uint32_t SSpawnRingCapacity = 4096;
+  /// Highest order of the fast multipole expansions. Must match
+  /// `FmmMaxOrder` in shader.
+  static constexpr uint32_t SFmmMaxOrder = 16;
 
 private:
   /*
@@ -60,6 +521,11 @@ private:
   void initVulkan();
   /// @brief Game loop that draws frames until user exists the program.
   void mainLoop();
+  /// @brief Simulation loop run on its own thread, which advances the particle
+  /// state as fast as the compute queue allows and publishes each completed
+  /// state to the renderer.
+  /// @param[in] stopToken Token signalled when the application is exiting.
+  void simulationLoop(std::stop_token stopToken);
   /// @brief Tears down GLFW instance on program exit.
   void cleanup();
 
@@ -84,38 +550,385 @@ private:
   /// @brief Loads vertex & fragment shaders,
   /// and creates graphics pipeline.
   void createGraphicsPipeline();
-  /// @brief Loads compute shader, and creates compute pipeline.
+  /// @brief Defines the descriptor set layout of the compute splatting
+  /// renderer, and creates its clear and splat pipelines.
+  void createSplatPipeline();
+  /// @brief Creates the pipelines, thickness targets and descriptor sets of
+  /// `Renderer::Surface`.
+  void createSurfaceRenderer();
+  /// @brief Writes a descriptor set for the compute splatting renderer for
+  /// every pair of simulation state and swapchain image.
+  void createSplatDescriptorSets();
+  /// @brief Loads compute shader, and creates the compute pipelines of the
+  /// kernel selected by `MOptions.kernel`.
   void createComputePipeline();
-  /// @brief Creates a command pool.
+  /// @brief Creates a pipeline for a compute shader entry-point using
+  /// `MComputePipelineLayout`.
+  /// @param[in] shaderModule Module containing the entry-point.
+  /// @param[in] entryPoint Name of the compute shader entry-point.
+  /// @param[in] layout Layout to use instead of `MComputePipelineLayout`.
+  /// @param[in] forceModules Mask of `ForceModule` to specialize for.
+  /// @returns The created pipeline.
+  [[nodiscard]] vk::raii::Pipeline
+  createComputeKernel(vk::raii::ShaderModule &shaderModule,
+                      const char *entryPoint,
+                      const vk::raii::PipelineLayout *layout = nullptr,
+                      uint32_t forceModules = 0);
+  /// @brief Gets the `compFused` pipeline specialized for a combination of
+  /// force modules, creating it on first use.
+  /// @param[in] forceModules Mask of `ForceModule` to enable.
+  vk::raii::Pipeline &getFusedPipeline(uint32_t forceModules);
+  /// @brief Loads the parallel primitives shader, and creates its pipelines
+  /// sharing a layout with a push descriptor set.
+  void createPrimitivePipelines();
+  /// @brief Creates a command pool for the render thread and one for the
+  /// simulation thread.
   void createCommandPool();
-  /// @brief Creates buffer for every frame of `Particle` objects copied to
-  /// GPU-only memory from host-visible staging memory.
+  /// @brief Creates a buffer for every simulation state of `Particle` objects
+  /// copied to GPU-only memory from host-visible staging memory.
   void createShaderStorageBuffers();
-  /// @brief Creates a persistently mapped uniformed buffer for every frame.
+  /// @brief Creates a transfer source buffer of the initial particles,
+  /// importing their host memory when supported rather than copying it into
+  /// a staging buffer.
+  /// @param[in] hostParticles Host memory of the initial particles.
+  /// @param[out] buffer Buffer created.
+  /// @param[out] bufferMemory Memory bound to `buffer`.
+  void createInitialParticleBuffer(const HostMapping &hostParticles,
+                                   vk::raii::Buffer &buffer,
+                                   vk::raii::DeviceMemory &bufferMemory);
+  /// @brief Binds memory to the sparse particle states until they hold at
+  /// least `particleCount` particles, a no-op without `MSparseStorage`.
+  /// @param[in] particleCount Number of particles about to be simulated.
+  void ensureStorageCapacity(uint32_t particleCount);
+  /// @brief Creates a persistently mapped uniformed buffer for every
+  /// simulation state.
   void createUniformBuffers();
+  /// @brief Creates the timestep bin counters, compacted index lists, and
+  /// indirect dispatch arguments used by the multi-rate kernel.
+  void createMultiRateBuffers();
+  /// @brief Creates the fp32 reference particle state and persistently mapped
+  /// error buffer used to measure the precision of the half kernel.
+  /// @param[in] stagingBuffer Buffer holding the initial particle data.
+  void createPrecisionErrorBuffers(vk::raii::Buffer &stagingBuffer);
+  /// @brief Creates the cell counts, cell starts, and sorted particle indices
+  /// of the two level grid used by the collide kernel and spatial queries.
+  void createGridBuffers();
+  /// @brief Creates the Verlet neighbour lists, and the persistently mapped
+  /// results of the reductions over them, used by `Options::neighbourLists`.
+  void createNeighbourListBuffers();
+  /// @brief Creates the persistently mapped query and result buffers used to
+  /// answer spatial queries.
+  void createSpatialQueryBuffers();
+  /// @brief Creates the persistently mapped spawn ring, and the sequence
+  /// numbers publishing its slots, used by `Options::injection`.
+  void createSpawnRingBuffer();
+  /// @brief Creates the charge, potential and field grids of the plasma
+  /// modes.
+  void createPlasmaBuffers();
+  /// @brief Arranges the initial particles into clusters of
+  /// `SimulationMode::Clusters`, and creates the buffers of their ranges and
+  /// rest shapes.
+  /// @param[in,out] particles Initial particle data, positioned, coloured and
+  /// given velocities by cluster.
+  void createClusterBuffers(std::span<Particle> particles);
+  /// @brief Creates the face velocities, cell counts, divergence and pressure
+  /// grids of `SimulationMode::Fluid`.
+  void createFluidBuffers();
+  /// @brief Creates the compact stream of `RenderVertex` of every simulation
+  /// state, bound as the vertex buffer of the graphics pipeline.
+  /// @param[in] particles Initial particle data, packed into every stream.
+  void createRenderStreamBuffers(std::span<const Particle> particles);
+  /// @brief Creates the expansions and fields of `ComputeKernel::Fmm`, and
+  /// the persistently mapped reference fields of its benchmark.
+  void createFmmBuffers();
+  /// @brief Creates the persistently mapped histogram buffer, and opens the
+  /// CSV file, used by `Options::analyticsFile`.
+  void createAnalytics();
+  /// @brief Creates the atomic work queue counter used by the persistent
+  /// threads kernel.
+  void createWorkQueueBuffer();
   /// @brief Defines descriptor pool for creating uniform and storage buffer
   /// descriptors from
   void createDescriptorPool();
-  /// @brief For every frame, writes a descriptor set of a uniform buffer with
-  /// the new time delta, as well as 2 storage buffers for the last and
-  /// current frame particle position.
+  /// @brief For every pair of input and output simulation states, writes a
+  /// descriptor set of a uniform buffer with the new time delta, as well as 2
+  /// storage buffers for the last and current particle positions.
   void createComputeDescriptorSets();
   /// @brief Creates a command-buffer to use for graphics commands for each of
   /// the possible frames in flight.
   void createGraphicsCommandBuffers();
   /// @brief Creates a command-buffer to use for compute commands for each of
-  /// the possible frames in flight.
+  /// the simulation states.
   void createComputeCommandBuffers();
-  /// @brief Creates timeline semaphore and fences for synchronization.
+  /// @brief Creates timeline semaphores and fences for synchronization.
   void createSyncObjects();
+  /// @brief Creates timestamp query pools used to time compute and graphics
+  /// work, if supported by the queue.
+  void createQueryPools();
 
   /// @brief Add commands to graphics command-buffer
   /// @param[in] imageIndex Index in swap chain of current image for frame.
   void recordGraphicsCommandBuffer(uint32_t imageIndex);
+  /// @brief Add commands to splat particles into a swapchain image with
+  /// compute shaders, instead of rendering with the graphics pipeline.
+  /// @param[in] imageIndex Index in swap chain of current image for frame.
+  void recordSplatCommands(uint32_t imageIndex);
+  /// @brief Add commands to splat and filter the thickness of the drawn
+  /// state with compute shaders, ready to shade in the render pass of
+  /// `Renderer::Surface`.
+  void recordSurfaceCommands();
   /// @brief Add commands to compute command-buffer
-  void recordComputeCommandBuffer();
-  /// @brief Submits the command-buffers to the queue,
-  /// and presents the new frame.
+  /// @param[in] inState Index of the simulation state to read from.
+  /// @param[in] outState Index of the simulation state to write to.
+  /// @param[in] particleCount Number of active particles to simulate.
+  void recordComputeCommandBuffer(uint32_t inState, uint32_t outState,
+                                  uint32_t particleCount);
+  /// @brief Add commands to bin particles by required timestep, and advance
+  /// each bin on the sub-steps it is due.
+  /// @param[in] commandBuffer Compute command-buffer being recorded.
+  /// @param[in] particleCount Number of active particles to simulate.
+  void recordMultiRateCommands(vk::raii::CommandBuffer &commandBuffer,
+                               uint32_t particleCount);
+  /// @brief Add commands to sort particles by fine grid cell, repairing the
+  /// previous sorted order when few enough particles changed cell since, and
+  /// leaving the descriptor set of the step bound.
+  /// @param[in] commandBuffer Compute command-buffer being recorded.
+  /// @param[in] inState Index of the simulation state to read from.
+  /// @param[in] outState Index of the simulation state to write to.
+  /// @param[in] particleCount Number of active particles to simulate.
+  void recordGridCommands(vk::raii::CommandBuffer &commandBuffer,
+                          uint32_t inState, uint32_t outState,
+                          uint32_t particleCount);
+  /// @brief Add commands to counting sort particles by fine grid cell from
+  /// scratch.
+  /// @param[in] commandBuffer Compute command-buffer being recorded.
+  /// @param[in] inState Index of the simulation state to read from.
+  /// @param[in] outState Index of the simulation state to write to.
+  /// @param[in] particleCount Number of active particles to simulate.
+  void recordGridRebuildCommands(vk::raii::CommandBuffer &commandBuffer,
+                                 uint32_t inState, uint32_t outState,
+                                 uint32_t particleCount);
+  /// @brief Add commands to repair the previous sorted order of the grid,
+  /// once compared against the current cells, by moving only the particles
+  /// which changed cell.
+  /// @param[in] commandBuffer Compute command-buffer being recorded.
+  /// @param[in] inState Index of the simulation state to read from.
+  /// @param[in] outState Index of the simulation state to write to.
+  /// @param[in] particleCount Number of active particles to simulate.
+  void recordGridMergeCommands(vk::raii::CommandBuffer &commandBuffer,
+                               uint32_t inState, uint32_t outState,
+                               uint32_t particleCount);
+  /// @brief Add commands to dispatch the bound compute pipeline over the
+  /// particles, with as many work-groups as `schedule` launches, resetting
+  /// the work queue first if it is pulled from.
+  /// @param[in] commandBuffer Compute command-buffer being recorded.
+  /// @param[in] particleCount Number of active particles to simulate.
+  /// @param[in] schedule Assignment of particles to invocations.
+  void recordScheduledDispatch(vk::raii::CommandBuffer &commandBuffer,
+                               uint32_t particleCount, Schedule schedule);
+  /// @brief Add commands to advance the collide kernel with Verlet neighbour
+  /// lists, rebuilding them first if the last step moved some particle more
+  /// than half the skin since they were built.
+  /// @param[in] commandBuffer Compute command-buffer being recorded.
+  /// @param[in] inState Index of the simulation state to read from.
+  /// @param[in] outState Index of the simulation state to write to.
+  /// @param[in] particleCount Number of active particles to simulate.
+  void recordNeighbourListCommands(vk::raii::CommandBuffer &commandBuffer,
+                                   uint32_t inState, uint32_t outState,
+                                   uint32_t particleCount);
+  /// @brief Add commands to answer the pending spatial queries which fit in
+  /// a step, building the grid over the input state to search.
+  /// @param[in] commandBuffer Compute command-buffer being recorded.
+  /// @param[in] inState Index of the simulation state to read from.
+  /// @param[in] outState Index of the simulation state to write to.
+  /// @param[in] particleCount Number of active particles to simulate.
+  void recordSpatialQueryCommands(vk::raii::CommandBuffer &commandBuffer,
+                                  uint32_t inState, uint32_t outState,
+                                  uint32_t particleCount);
+  /// @brief Fulfils the spatial query batches answered by the last step,
+  /// which must have completed.
+  void completeSpatialQueries();
+  /// @brief Submits a query around the last click, and prints the results of
+  /// the previous query once answered.
+  void updateCursorQuery();
+  /// @brief Takes the particles published to the spawn ring, in order, to be
+  /// injected by the next step.
+  /// @param[in] particleCount Number of active particles, the most which can
+  /// be injected by a step.
+  void acquireSpawnRecords(uint32_t particleCount);
+  /// @brief Add commands to write the particles taken from the spawn ring
+  /// over the output state.
+  /// @param[in] commandBuffer Compute command-buffer being recorded.
+  void recordInjectCommands(vk::raii::CommandBuffer &commandBuffer);
+  /// @brief Frees the slots of the spawn ring injected by the last step,
+  /// which must have completed.
+  void releaseSpawnRecords();
+  /// @brief Injects a burst of particles at the last right click.
+  void updateCursorSpawn();
+  /// @brief Add commands to build the grid over the input state, and bin the
+  /// speed of every particle and the distance between every nearby pair.
+  /// @param[in] commandBuffer Compute command-buffer being recorded.
+  /// @param[in] inState Index of the simulation state to read from.
+  /// @param[in] outState Index of the simulation state to write to.
+  /// @param[in] particleCount Number of active particles to simulate.
+  void recordAnalyticsCommands(vk::raii::CommandBuffer &commandBuffer,
+                               uint32_t inState, uint32_t outState,
+                               uint32_t particleCount);
+  /// @brief Appends the histograms measured by the last step, which must
+  /// have completed, to `Options::analyticsFile`.
+  /// @param[in] time Time of the step in seconds.
+  /// @param[in] particleCount Number of particles measured.
+  void writeAnalytics(double time, uint32_t particleCount);
+  /// @returns Whether the two level grid is used, by the collide kernel or to
+  /// answer spatial queries and measure analytics, or as the quadtree of
+  /// the fast multipole method.
+  bool usesGrid() const {
+    return MOptions.kernel == ComputeKernel::Collide ||
+           MOptions.kernel == ComputeKernel::Fmm || MOptions.spatialQueries ||
+           !MOptions.analyticsFile.empty();
+  }
+  /// @returns Whether particles are pulled from the atomic work queue.
+  bool usesWorkQueue() const {
+    return MOptions.kernel == ComputeKernel::Persistent ||
+           MOptions.schedule == Schedule::Queue;
+  }
+  /// @returns Whether the parallel primitives are used, by the grid or their
+  /// benchmark, which requires push descriptors.
+  bool usesPrimitives() const {
+    return MOptions.benchmarkPrimitives || usesGrid();
+  }
+  /// @returns Whether particles are advanced as a particle-in-cell plasma.
+  bool usesPlasma() const {
+    return MOptions.mode == SimulationMode::Plasma ||
+           MOptions.mode == SimulationMode::MagnetisedPlasma;
+  }
+  /// @brief Add commands to deposit charge on the plasma grid, solve for
+  /// the potential, and push the particles through the resulting field,
+  /// timing each stage.
+  /// @param[in] commandBuffer Compute command-buffer being recorded.
+  /// @param[in] outState Index of the simulation state to write to.
+  /// @param[in] particleCount Number of active particles to simulate.
+  void recordPlasmaCommands(vk::raii::CommandBuffer &commandBuffer,
+                            uint32_t outState, uint32_t particleCount);
+  /// @brief Add commands to transfer particle velocities to the fluid grid,
+  /// project them divergence free, and transfer them back to advance the
+  /// particles, timing each stage.
+  /// @param[in] commandBuffer Compute command-buffer being recorded.
+  /// @param[in] outState Index of the simulation state to write to.
+  /// @param[in] particleCount Number of active particles to simulate.
+  void recordFluidCommands(vk::raii::CommandBuffer &commandBuffer,
+                           uint32_t outState, uint32_t particleCount);
+  /// @returns Whether steps write a `RenderVertex` stream, for the graphics
+  /// pipeline to draw. The compute renderer may fall back to the graphics
+  /// pipeline, so only the surface renderer never draws points.
+  bool usesRenderStream() const {
+    return MOptions.renderer != Renderer::Surface;
+  }
+  /// @returns Whether the step is split into stages timed separately, by
+  /// the particle-in-cell plasma and fluid modes.
+  bool usesStageTimes() const {
+    return usesPlasma() || MOptions.mode == SimulationMode::Fluid;
+  }
+  /// @brief Add commands to build the quadtree, pass expansions up and down
+  /// it, and advance the particles by the far and near field.
+  /// @param[in] commandBuffer Compute command-buffer being recorded.
+  /// @param[in] inState Index of the simulation state to read from.
+  /// @param[in] outState Index of the simulation state to write to.
+  /// @param[in] particleCount Number of active particles to simulate.
+  void recordFmmCommands(vk::raii::CommandBuffer &commandBuffer,
+                         uint32_t inState, uint32_t outState,
+                         uint32_t particleCount);
+  /// @brief Add commands to advance the fp32 reference state, and record the
+  /// largest position error of the output state against it.
+  /// @param[in] commandBuffer Compute command-buffer being recorded.
+  /// @param[in] particleCount Number of active particles to simulate.
+  void recordPrecisionErrorCommands(vk::raii::CommandBuffer &commandBuffer,
+                                    uint32_t particleCount);
+  /// @brief Pushes the buffers operated on by a parallel primitive.
+  /// @param[in] commandBuffer Command-buffer being recorded.
+  /// @param[in] buffers Buffer of each binding in primitives.slang, null for
+  /// bindings the primitive doesn't use.
+  void pushPrimitiveDescriptors(vk::raii::CommandBuffer &commandBuffer,
+                                const std::array<vk::Buffer, 5> &buffers);
+  /// @brief Bytes of scratch buffer needed by a parallel primitive.
+  /// @param[in] count Number of elements operated on.
+  static vk::DeviceSize primitiveScratchSize(uint32_t count);
+  // The `record*` parallel primitives operate on `uint32_t` elements and
+  // bind their own pipelines and descriptors, so callers rebind theirs
+  // after. Results are written by compute shaders, so need a barrier before
+  // use. Outputs and scratch are cleared with fills, so need transfer
+  // destination usage.
+  /// @brief Add commands to reduce a buffer to a single element.
+  /// @param[in] commandBuffer Command-buffer being recorded.
+  /// @param[in] input Elements to reduce.
+  /// @param[in] output Buffer the result is written to the start of.
+  /// @param[in] count Number of elements.
+  /// @param[in] op Operation combining elements.
+  void recordReduce(vk::raii::CommandBuffer &commandBuffer, vk::Buffer input,
+                    vk::Buffer output, uint32_t count, PrimitiveOp op);
+  /// @brief Add commands for an exclusive prefix sum of a buffer, which must
+  /// sum to less than 2^30.
+  /// @param[in] commandBuffer Command-buffer being recorded.
+  /// @param[in] input Elements to scan.
+  /// @param[in] output Buffer of `count` elements to write the scan to.
+  /// @param[in] scratch Buffer of `primitiveScratchSize(count)` bytes.
+  /// @param[in] count Number of elements.
+  void recordExclusiveScan(vk::raii::CommandBuffer &commandBuffer,
+                           vk::Buffer input, vk::Buffer output,
+                           vk::Buffer scratch, uint32_t count);
+  /// @brief Add commands to stably compact the elements of a buffer which
+  /// have a non-zero flag.
+  /// @param[in] commandBuffer Command-buffer being recorded.
+  /// @param[in] input Elements to compact.
+  /// @param[in] flags Flag of each element, non-zero to keep it.
+  /// @param[in] output Buffer of `count` elements to compact into.
+  /// @param[in] outputCount Buffer the number kept is written to the start
+  /// of.
+  /// @param[in] scratch Buffer of `primitiveScratchSize(count)` bytes.
+  /// @param[in] count Number of elements.
+  void recordCompact(vk::raii::CommandBuffer &commandBuffer, vk::Buffer input,
+                     vk::Buffer flags, vk::Buffer output,
+                     vk::Buffer outputCount, vk::Buffer scratch,
+                     uint32_t count);
+  /// @brief Add commands to stably sort keys and their values in place.
+  /// @param[in] commandBuffer Command-buffer being recorded.
+  /// @param[in] keys Keys to sort.
+  /// @param[in] values Value of each key, moved along with it.
+  /// @param[in] tempKeys Buffer of `count` elements to ping-pong keys with.
+  /// @param[in] tempValues Buffer of `count` elements to ping-pong values
+  /// with.
+  /// @param[in] scratch Buffer of `primitiveScratchSize(count)` bytes.
+  /// @param[in] count Number of keys.
+  /// @param[in] keyBits Number of low bits of the keys to sort on, the rest
+  /// of which must be zero.
+  void recordRadixSort(vk::raii::CommandBuffer &commandBuffer,
+                       vk::Buffer keys, vk::Buffer values,
+                       vk::Buffer tempKeys, vk::Buffer tempValues,
+                       vk::Buffer scratch, uint32_t count,
+                       uint32_t keyBits = 32);
+  /// @brief Checks each parallel primitive against the standard library on
+  /// random data of several sizes, and prints its throughput.
+  void benchmarkPrimitives();
+  /// @brief Prints the step time and error against all-pairs summation of
+  /// the fast multipole method at several sizes and orders.
+  void benchmarkFmm();
+  /// @brief Prints statistics of the simulation since the last report.
+  /// @param[in] steps Number of simulation steps completed.
+  /// @param[in] elapsed Seconds elapsed.
+  /// @param[in] computeTime Total GPU milliseconds of the steps.
+  /// @param[in] particleCount Number of active particles.
+  void printSimulationStats(uint32_t steps, double elapsed, double computeTime,
+                            uint32_t particleCount);
+  /// @brief Submits a single simulation step to the compute queue.
+  /// @param[in] inState Index of the simulation state to read from.
+  /// @param[in] outState Index of the simulation state to write to.
+  /// @param[in] deltaTime Time step to advance the simulation by.
+  /// @param[in] particleCount Number of active particles to simulate.
+  /// @returns Compute timeline value signalled when the step completes.
+  uint64_t submitSimulationStep(uint32_t inState, uint32_t outState,
+                                float deltaTime, uint32_t particleCount);
+  /// @brief Picks up the latest simulation state, submits the graphics
+  /// command-buffer to the queue, and presents the new frame.
   void drawFrame();
   /// @brief Reconfigures the swap chain image formats if the window is resized.
   void recreateSwapChain();
@@ -128,32 +941,152 @@ private:
   /// @param[in] Size Number of bytes to copy.
   void copyBuffer(vk::raii::Buffer &srcBuffer, vk::raii::Buffer &dstBuffer,
                   vk::DeviceSize size);
+  /// @brief Locks `MQueueMutex` if the simulation and render threads share a
+  /// queue, otherwise returns a lock which doesn't own the mutex.
+  [[nodiscard]] std::unique_lock<std::mutex> lockSharedQueue();
   /// @brief Sets the uniform buffer object data to the latest time delta.
-  void updateUniformBuffer(uint32_t currentImage);
+  /// @param[in] outState Index of the simulation state being written.
+  /// @param[in] deltaTime Time step to advance the simulation by.
+  /// @param[in] particleCount Number of active particles to simulate.
+  void updateUniformBuffer(uint32_t outState, float deltaTime,
+                           uint32_t particleCount);
+  /// @brief Reads a pair of begin/end timestamps written to a query pool.
+  /// @param[in] queryPool Pool the timestamps were written to.
+  /// @param[in] firstQuery Index of the begin timestamp query.
+  /// @returns Milliseconds elapsed between the two timestamps.
+  double readTimestampQueries(vk::raii::QueryPool &queryPool,
+                              uint32_t firstQuery);
+  /// @brief Writes the timestamp before the first stage of a step, or after
+  /// one of its stages, if timestamps are supported.
+  /// @param[in] commandBuffer Compute command-buffer being recorded.
+  /// @param[in] outState Index of the simulation state being written.
+  /// @param[in] stage Number of stages completed.
+  void writeStageTimestamp(vk::raii::CommandBuffer &commandBuffer,
+                           uint32_t outState, uint32_t stage);
 
   /*
    * Member variables
    */
 
+  Options MOptions;
+  /// @brief `Options::seed`, or the time of startup when unset.
+  uint32_t MSeed =
+      MOptions.seed.value_or(static_cast<uint32_t>(time(nullptr)));
   GLFWwindow *MWindow = nullptr;
   vk::raii::Context MContext;
   vk::raii::Instance MInstance = nullptr;
   vk::raii::DebugUtilsMessengerEXT MDebugMessenger = nullptr;
   vk::raii::SurfaceKHR MSurface = nullptr;
   vk::raii::PhysicalDevice MPhysicalDevice = nullptr;
+  /// @brief Set if `shaderFloat16` and 16-bit storage buffer access are
+  /// supported, which `ComputeKernel::Half` requires.
+  bool MSupportsFloat16 = false;
+  /// @brief Set if storage images can be written without a format, which
+  /// `Renderer::Compute` requires to write BGRA swapchain images.
+  bool MSupportsStorageWriteWithoutFormat = false;
+  /// @brief Set if host memory can be imported with
+  /// `VK_EXT_external_memory_host`, to upload the initial particles from.
+  bool MSupportsHostImport = false;
+  /// @brief Alignment of the address and size of imported host memory.
+  vk::DeviceSize MHostImportAlignment = 0;
+  /// @brief Set if the particle states are sparse buffers, which requires
+  /// sparse buffer residency and a queue that supports sparse binding.
+  bool MSparseStorage = false;
   vk::raii::Device MDevice = nullptr;
   uint32_t MQueueIndex = ~0;
   vk::raii::Queue MQueue = nullptr;
+  /// @brief Queue the simulation thread submits to, the same queue as
+  /// `MQueue` if the queue family only exposes a single queue.
+  vk::raii::Queue MComputeQueue = nullptr;
+  bool MComputeQueueShared = false;
+  /// @brief Guards submissions when `MComputeQueueShared` is set.
+  std::mutex MQueueMutex;
   vk::raii::SwapchainKHR MSwapChain = nullptr;
   std::vector<vk::Image> MSwapChainImages;
   vk::SurfaceFormatKHR MSwapChainSurfaceFormat;
   vk::Extent2D MSwapChainExtent;
   std::vector<vk::raii::ImageView> MSwapChainImageViews;
+  /// @brief Set if the compute splatting renderer is used, which requires the
+  /// surface to support storage swapchain images.
+  bool MComputePresent = false;
+  /// @brief Set once the first swapchain has chosen its format and
+  /// `MComputePresent`, which recreated swapchains keep as the pipelines are
+  /// built for them.
+  bool MSwapChainFormatChosen = false;
 
   vk::raii::PipelineLayout MPipelineLayout = nullptr;
   vk::raii::PipelineLayout MComputePipelineLayout = nullptr;
   vk::raii::Pipeline MGraphicsPipeline = nullptr;
+  vk::raii::DescriptorSetLayout MSplatDescriptorSetLayout = nullptr;
+  vk::raii::PipelineLayout MSplatPipelineLayout = nullptr;
+  vk::raii::Pipeline MSplatClearPipeline = nullptr;
+  vk::raii::Pipeline MSplatPipeline = nullptr;
+  /// @brief Sets indexed by `state * MSwapChainImages.size() + imageIndex`,
+  /// reallocated from their own pool when the swapchain is recreated.
+  vk::raii::DescriptorPool MSplatDescriptorPool = nullptr;
+  std::vector<vk::raii::DescriptorSet> MSplatDescriptorSets;
+  vk::raii::DescriptorSetLayout MSurfaceDescriptorSetLayout = nullptr;
+  vk::raii::PipelineLayout MSurfacePipelineLayout = nullptr;
+  vk::raii::Pipeline MSurfaceSplatPipeline = nullptr;
+  vk::raii::Pipeline MSurfaceFilterPipeline = nullptr;
+  vk::raii::Pipeline MSurfaceShadePipeline = nullptr;
+  /// @brief Set for each simulation state drawn by `Renderer::Surface`.
+  vk::raii::DescriptorPool MSurfaceDescriptorPool = nullptr;
+  std::vector<vk::raii::DescriptorSet> MSurfaceDescriptorSets;
+  /// @brief Fixed point thickness splatted into each pixel of the surface
+  /// target, and the thickness after each pass of the filter.
+  vk::raii::Buffer MSurfaceThicknessBuffer = nullptr;
+  vk::raii::DeviceMemory MSurfaceThicknessBufferMemory = nullptr;
+  vk::raii::Buffer MSurfaceFilteredBuffer = nullptr;
+  vk::raii::DeviceMemory MSurfaceFilteredBufferMemory = nullptr;
   vk::raii::Pipeline MComputePipeline = nullptr;
+  vk::raii::Pipeline MMultiRateBinPipeline = nullptr;
+  vk::raii::Pipeline MMultiRateArgsPipeline = nullptr;
+  vk::raii::Pipeline MMultiRateStepPipeline = nullptr;
+  vk::raii::Pipeline MPrecisionErrorPipeline = nullptr;
+  vk::raii::Pipeline MGridCountPipeline = nullptr;
+  vk::raii::Pipeline MGridScatterPipeline = nullptr;
+  vk::raii::Pipeline MGridComparePipeline = nullptr;
+  vk::raii::Pipeline MGridStartsPipeline = nullptr;
+  vk::raii::Pipeline MGridMergePipeline = nullptr;
+  vk::raii::Pipeline MNeighbourBuildPipeline = nullptr;
+  vk::raii::Pipeline MSpatialQueryPipeline = nullptr;
+  vk::raii::Pipeline MInjectPipeline = nullptr;
+  vk::raii::Pipeline MSpeedHistogramPipeline = nullptr;
+  vk::raii::Pipeline MPairHistogramPipeline = nullptr;
+  vk::raii::Pipeline MPlasmaDepositPipeline = nullptr;
+  vk::raii::Pipeline MPlasmaSolvePipeline = nullptr;
+  vk::raii::Pipeline MPlasmaFieldPipeline = nullptr;
+  vk::raii::Pipeline MPlasmaPushPipeline = nullptr;
+  vk::raii::Pipeline MFluidTransferPipeline = nullptr;
+  vk::raii::Pipeline MFluidNormalisePipeline = nullptr;
+  vk::raii::Pipeline MFluidDivergencePipeline = nullptr;
+  vk::raii::Pipeline MFluidJacobiPipeline = nullptr;
+  vk::raii::Pipeline MFluidProjectPipeline = nullptr;
+  vk::raii::Pipeline MFluidGatherPipeline = nullptr;
+  vk::raii::Pipeline MShapeMatchPipeline = nullptr;
+  vk::raii::Pipeline MRenderStreamPipeline = nullptr;
+  vk::raii::Pipeline MFmmMultipolePipeline = nullptr;
+  vk::raii::Pipeline MFmmUpwardPipeline = nullptr;
+  vk::raii::Pipeline MFmmInteractPipeline = nullptr;
+  vk::raii::Pipeline MFmmDownwardPipeline = nullptr;
+  vk::raii::Pipeline MFmmNearPipeline = nullptr;
+  vk::raii::Pipeline MFmmDirectPipeline = nullptr;
+  /// @brief Parallel primitives from primitives.slang
+  vk::raii::DescriptorSetLayout MPrimitiveDescriptorSetLayout = nullptr;
+  vk::raii::PipelineLayout MPrimitivePipelineLayout = nullptr;
+  vk::raii::Pipeline MReducePipeline = nullptr;
+  vk::raii::Pipeline MExclusiveScanPipeline = nullptr;
+  vk::raii::Pipeline MCompactPipeline = nullptr;
+  vk::raii::Pipeline MRadixHistogramPipeline = nullptr;
+  vk::raii::Pipeline MRadixHistogramScanPipeline = nullptr;
+  vk::raii::Pipeline MRadixScatterPipeline = nullptr;
+  /// @brief Module holding `compFused`, kept to specialize more pipelines as
+  /// force modules are toggled.
+  vk::raii::ShaderModule MFusedShaderModule = nullptr;
+  /// @brief `compFused` pipelines keyed by `ForceModule` mask, only accessed
+  /// by the simulation thread after creation.
+  std::unordered_map<uint32_t, vk::raii::Pipeline> MFusedPipelines;
 
   vk::raii::DescriptorSetLayout MComputeDescriptorSetLayout = nullptr;
   vk::raii::DescriptorPool MDescriptorPool = nullptr;
@@ -161,22 +1094,299 @@ private:
 
   std::vector<vk::raii::Buffer> MShaderStorageBuffers;
   std::vector<vk::raii::DeviceMemory> MShaderStorageBuffersMemory;
+  /// @brief `RenderVertex` of each particle for every simulation state,
+  /// written by the step writing the state.
+  std::vector<vk::raii::Buffer> MRenderStreamBuffers;
+  std::vector<vk::raii::DeviceMemory> MRenderStreamBuffersMemory;
+  /// @brief Chunks of memory bound to the sparse particle states, in order of
+  /// offset with a chunk for each state at every offset.
+  std::vector<vk::raii::DeviceMemory> MSparseMemory;
+  /// @brief Host memory of the initial particles, kept alive for as long as
+  /// `MInitialParticleBuffer` when it is imported rather than a copy.
+  HostMapping MInitialParticleHost;
+  /// @brief Initial data of every particle, copied into newly bound chunks.
+  vk::raii::Buffer MInitialParticleBuffer = nullptr;
+  vk::raii::DeviceMemory MInitialParticleBufferMemory = nullptr;
+  uint32_t MSparseMemoryType = 0;
+  /// @brief Bytes bound at a time, a multiple of the sparse block size.
+  vk::DeviceSize MSparseChunkSize = 0;
+  /// @brief Size of each sparse buffer, as required by the implementation.
+  vk::DeviceSize MSparseStorageSize = 0;
+  /// @brief Particles backed by bound memory in every state, only accessed by
+  /// the simulation thread after creation.
+  uint32_t MCommittedParticles = SMaxParticleCount;
+  /// @brief Particles whose initial data has been copied into every state.
+  uint32_t MUploadedParticles = SMaxParticleCount;
 
   std::vector<vk::raii::Buffer> MUniformBuffers;
   std::vector<vk::raii::DeviceMemory> MUniformBuffersMemory;
   std::vector<void *> MUniformBuffersMapped;
 
+  /// @brief Number of particles in each timestep bin.
+  vk::raii::Buffer MMultiRateCountBuffer = nullptr;
+  vk::raii::DeviceMemory MMultiRateCountBufferMemory = nullptr;
+  /// @brief Compacted list of particle indices in each timestep bin.
+  vk::raii::Buffer MMultiRateIndexBuffer = nullptr;
+  vk::raii::DeviceMemory MMultiRateIndexBufferMemory = nullptr;
+  /// @brief `vk::DispatchIndirectCommand` for each timestep bin.
+  vk::raii::Buffer MMultiRateArgsBuffer = nullptr;
+  vk::raii::DeviceMemory MMultiRateArgsBufferMemory = nullptr;
+
+  /// @brief fp32 particle state advanced in place alongside the half kernel.
+  vk::raii::Buffer MReferenceBuffer = nullptr;
+  vk::raii::DeviceMemory MReferenceBufferMemory = nullptr;
+  /// @brief Largest position error of the last step as float bits.
+  vk::raii::Buffer MPrecisionErrorBuffer = nullptr;
+  vk::raii::DeviceMemory MPrecisionErrorBufferMemory = nullptr;
+  uint32_t *MPrecisionErrorMapped = nullptr;
+
+  /// @brief Particles in each fine grid cell, reused as scatter cursors.
+  vk::raii::Buffer MGridCellCountBuffer = nullptr;
+  vk::raii::DeviceMemory MGridCellCountBufferMemory = nullptr;
+  /// @brief Sorted index of the first particle in each fine grid cell.
+  vk::raii::Buffer MGridCellStartBuffer = nullptr;
+  vk::raii::DeviceMemory MGridCellStartBufferMemory = nullptr;
+  /// @brief Particle indices sorted by fine grid cell.
+  vk::raii::Buffer MGridSortedBuffer = nullptr;
+  vk::raii::DeviceMemory MGridSortedBufferMemory = nullptr;
+  /// @brief Fine cell of each sorted particle when it was sorted.
+  vk::raii::Buffer MGridSortedCellBuffer = nullptr;
+  vk::raii::DeviceMemory MGridSortedCellBufferMemory = nullptr;
+  /// @brief Scratch of the scans building the grid.
+  vk::raii::Buffer MGridScratchBuffer = nullptr;
+  vk::raii::DeviceMemory MGridScratchBufferMemory = nullptr;
+  /// @brief Previous sorted order, and current cells, compared by an
+  /// incremental grid build.
+  vk::raii::Buffer MGridSlotIndexBuffer = nullptr;
+  vk::raii::DeviceMemory MGridSlotIndexBufferMemory = nullptr;
+  vk::raii::Buffer MGridSlotCellBuffer = nullptr;
+  vk::raii::DeviceMemory MGridSlotCellBufferMemory = nullptr;
+  /// @brief Whether each slot stayed in its cell, and the scan of that.
+  vk::raii::Buffer MGridStayFlagBuffer = nullptr;
+  vk::raii::DeviceMemory MGridStayFlagBufferMemory = nullptr;
+  vk::raii::Buffer MGridStayRankBuffer = nullptr;
+  vk::raii::DeviceMemory MGridStayRankBufferMemory = nullptr;
+  /// @brief Departures from each fine cell, and the scan of departures and
+  /// arrivals, with arrivals counted into `MGridCellCountBuffer`.
+  vk::raii::Buffer MGridDepartureCountBuffer = nullptr;
+  vk::raii::DeviceMemory MGridDepartureCountBufferMemory = nullptr;
+  vk::raii::Buffer MGridDepartureStartBuffer = nullptr;
+  vk::raii::DeviceMemory MGridDepartureStartBufferMemory = nullptr;
+  vk::raii::Buffer MGridArrivalStartBuffer = nullptr;
+  vk::raii::DeviceMemory MGridArrivalStartBufferMemory = nullptr;
+  /// @brief Particles which changed cell as of the last compare.
+  vk::raii::Buffer MGridChurnBuffer = nullptr;
+  vk::raii::DeviceMemory MGridChurnBufferMemory = nullptr;
+  uint32_t *MGridChurnMapped = nullptr;
+  /// @brief Particles in the sorted order as of the last build, zero until
+  /// the first. Grid state below is only accessed by the simulation thread.
+  uint32_t MGridSortedCount = 0;
+  /// @brief Grid builds recorded, used to interleave reference full builds.
+  uint32_t MGridBuildCount = 0;
+  /// @brief How the last recorded step built the grid, and whether it
+  /// compared against the previous sorted order.
+  GridBuild MGridBuild = GridBuild::None;
+  bool MGridCompared = false;
+  GridStats MGridStats;
+
+  /// @brief Fixed point charge deposited on each plasma grid node.
+  vk::raii::Buffer MPlasmaChargeBuffer = nullptr;
+  vk::raii::DeviceMemory MPlasmaChargeBufferMemory = nullptr;
+  /// @brief Electric potential at each node, the initial guess of each solve.
+  vk::raii::Buffer MPlasmaPotentialBuffer = nullptr;
+  vk::raii::DeviceMemory MPlasmaPotentialBufferMemory = nullptr;
+  /// @brief Electric field at each node.
+  vk::raii::Buffer MPlasmaFieldBuffer = nullptr;
+  vk::raii::DeviceMemory MPlasmaFieldBufferMemory = nullptr;
+  /// @brief Whether the potential has been zeroed by a recorded step, only
+  /// accessed by the simulation thread.
+  bool MPlasmaPotentialCleared = false;
+
+  /// @brief Momentum and weight transferred from the particles to each fluid
+  /// grid face, in fixed point.
+  vk::raii::Buffer MFluidMomentumBuffer = nullptr;
+  vk::raii::DeviceMemory MFluidMomentumBufferMemory = nullptr;
+  vk::raii::Buffer MFluidWeightBuffer = nullptr;
+  vk::raii::DeviceMemory MFluidWeightBufferMemory = nullptr;
+  /// @brief Velocity of each face after projection, and as transferred from
+  /// the particles.
+  vk::raii::Buffer MFluidVelocityBuffer = nullptr;
+  vk::raii::DeviceMemory MFluidVelocityBufferMemory = nullptr;
+  vk::raii::Buffer MFluidSavedVelocityBuffer = nullptr;
+  vk::raii::DeviceMemory MFluidSavedVelocityBufferMemory = nullptr;
+  /// @brief Particles in each fluid grid cell.
+  vk::raii::Buffer MFluidCellCountBuffer = nullptr;
+  vk::raii::DeviceMemory MFluidCellCountBufferMemory = nullptr;
+  /// @brief Divergence of each cell, and two copies of its pressure read and
+  /// written alternately by the Jacobi iterations.
+  vk::raii::Buffer MFluidDivergenceBuffer = nullptr;
+  vk::raii::DeviceMemory MFluidDivergenceBufferMemory = nullptr;
+  vk::raii::Buffer MFluidPressureBuffer = nullptr;
+  vk::raii::DeviceMemory MFluidPressureBufferMemory = nullptr;
+  /// @brief Whether the pressure has been zeroed by a recorded step, only
+  /// accessed by the simulation thread.
+  bool MFluidPressureCleared = false;
+
+  /// @brief `ClusterRange` of every cluster, and `ClusterMember` of every
+  /// particle, of `SimulationMode::Clusters`.
+  vk::raii::Buffer MClusterRangeBuffer = nullptr;
+  vk::raii::DeviceMemory MClusterRangeBufferMemory = nullptr;
+  vk::raii::Buffer MClusterMemberBuffer = nullptr;
+  vk::raii::DeviceMemory MClusterMemberBufferMemory = nullptr;
+
+  /// @brief GPU time in milliseconds of each stage of the plasma or fluid
+  /// steps since the last statistics report.
+  std::array<double, 4> MStageTimes{};
+
+  /// @brief `SFmmMaxOrder + 1` multipole and local coefficients of each
+  /// quadtree cell.
+  vk::raii::Buffer MFmmMultipoleBuffer = nullptr;
+  vk::raii::DeviceMemory MFmmMultipoleBufferMemory = nullptr;
+  vk::raii::Buffer MFmmLocalBuffer = nullptr;
+  vk::raii::DeviceMemory MFmmLocalBufferMemory = nullptr;
+  /// @brief Field at each particle from the last step.
+  vk::raii::Buffer MFmmFieldBuffer = nullptr;
+  vk::raii::DeviceMemory MFmmFieldBufferMemory = nullptr;
+  /// @brief All-pairs field at `SFmmSampleCount` particles, only created for
+  /// the benchmark.
+  vk::raii::Buffer MFmmReferenceBuffer = nullptr;
+  vk::raii::DeviceMemory MFmmReferenceBufferMemory = nullptr;
+  glm::vec2 *MFmmReferenceMapped = nullptr;
+
+  /// @brief Neighbour indices of each particle, `SNeighbourCapacity` apart.
+  vk::raii::Buffer MNeighbourListBuffer = nullptr;
+  vk::raii::DeviceMemory MNeighbourListBufferMemory = nullptr;
+  /// @brief Number of neighbours of each particle, which may be more than
+  /// its list holds.
+  vk::raii::Buffer MNeighbourCountBuffer = nullptr;
+  vk::raii::DeviceMemory MNeighbourCountBufferMemory = nullptr;
+  /// @brief Position of each particle when its list was built.
+  vk::raii::Buffer MNeighbourOriginBuffer = nullptr;
+  vk::raii::DeviceMemory MNeighbourOriginBufferMemory = nullptr;
+  /// @brief Squared distance of each particle from its origin as float bits.
+  vk::raii::Buffer MNeighbourDisplacementBuffer = nullptr;
+  vk::raii::DeviceMemory MNeighbourDisplacementBufferMemory = nullptr;
+  /// @brief Largest squared displacement after the last step as float bits.
+  vk::raii::Buffer MNeighbourMaxDisplacementBuffer = nullptr;
+  vk::raii::DeviceMemory MNeighbourMaxDisplacementBufferMemory = nullptr;
+  uint32_t *MNeighbourMaxDisplacementMapped = nullptr;
+  /// @brief Sum of the neighbour counts as of the last rebuild.
+  vk::raii::Buffer MNeighbourTotalBuffer = nullptr;
+  vk::raii::DeviceMemory MNeighbourTotalBufferMemory = nullptr;
+  uint32_t *MNeighbourTotalMapped = nullptr;
+  /// @brief Most neighbours of any particle as of the last rebuild, those
+  /// with more than `SNeighbourCapacity` querying the grid instead.
+  vk::raii::Buffer MNeighbourMaxCountBuffer = nullptr;
+  vk::raii::DeviceMemory MNeighbourMaxCountBufferMemory = nullptr;
+  uint32_t *MNeighbourMaxCountMapped = nullptr;
+  /// @brief Particles with a neighbour list as of the last rebuild, zero
+  /// until the first. Only accessed by the simulation thread.
+  uint32_t MNeighbourListCount = 0;
+  /// @brief Neighbour list rebuilds since the last statistics report.
+  uint32_t MNeighbourRebuilds = 0;
+
+  /// @brief `SMaxSpatialQueries` queries written by the host.
+  vk::raii::Buffer MSpatialQueryBuffer = nullptr;
+  vk::raii::DeviceMemory MSpatialQueryBufferMemory = nullptr;
+  SpatialQuery *MSpatialQueryMapped = nullptr;
+  /// @brief Number matched followed by `SSpatialQueryCapacity` particle
+  /// indices for each query.
+  vk::raii::Buffer MSpatialResultBuffer = nullptr;
+  vk::raii::DeviceMemory MSpatialResultBufferMemory = nullptr;
+  uint32_t *MSpatialResultMapped = nullptr;
+  /// @brief Guards `MPendingSpatialQueries`.
+  std::mutex MSpatialQueryMutex;
+  /// @brief Batches submitted but not yet recorded into a step.
+  std::deque<SpatialQueryBatch> MPendingSpatialQueries;
+  /// @brief Batches recorded into the last step, only accessed by the
+  /// simulation thread.
+  std::vector<SpatialQueryBatch> MRecordedSpatialQueries;
+  /// @brief Results of the last cursor query, only accessed by the render
+  /// thread.
+  std::future<std::vector<SpatialQueryResult>> MCursorQuery;
+
+  /// @brief Ring of `SSpawnRingCapacity` particles written by the host and
+  /// read by the step injecting them.
+  vk::raii::Buffer MSpawnRingBuffer = nullptr;
+  vk::raii::DeviceMemory MSpawnRingBufferMemory = nullptr;
+  SpawnRecord *MSpawnRingMapped = nullptr;
+  /// @brief Sequence number of each ring slot, set to one past the position
+  /// of the particle written to it once the write is complete. Lets the
+  /// simulation thread take particles in order without producers waiting on
+  /// each other.
+  std::unique_ptr<std::atomic<uint64_t>[]> MSpawnSequences;
+  /// @brief Positions reserved by producers, and released by the simulation
+  /// thread once the step injecting them has completed.
+  std::atomic<uint64_t> MSpawnReserved = 0;
+  std::atomic<uint64_t> MSpawnReleased = 0;
+  /// @brief Position and number of the particles taken by the last step,
+  /// the first particle they replace, and the next to replace after them.
+  /// Only accessed by the simulation thread.
+  uint64_t MSpawnFirst = 0;
+  uint32_t MSpawnCount = 0;
+  uint32_t MSpawnTarget = 0;
+  uint32_t MSpawnCursor = 0;
+
+  /// @brief `SAnalyticsBins` speed bins followed by as many pair distance
+  /// bins, accumulated by the step measuring analytics.
+  vk::raii::Buffer MAnalyticsBuffer = nullptr;
+  vk::raii::DeviceMemory MAnalyticsBufferMemory = nullptr;
+  uint32_t *MAnalyticsMapped = nullptr;
+  /// @brief Output of `Options::analyticsFile`.
+  std::ofstream MAnalyticsFile;
+  /// @brief Steps recorded since analytics were last measured, and whether
+  /// the last step measured them. Only accessed by the simulation thread.
+  uint32_t MAnalyticsStep = 0;
+  bool MAnalyticsRecorded = false;
+
+  /// @brief Index of the next particle to be claimed by a persistent thread.
+  vk::raii::Buffer MWorkQueueBuffer = nullptr;
+  vk::raii::DeviceMemory MWorkQueueBufferMemory = nullptr;
+
   vk::raii::CommandPool MCommandPool = nullptr;
+  vk::raii::CommandPool MComputeCommandPool = nullptr;
   std::vector<vk::raii::CommandBuffer> MGraphicsCommandBuffers;
   std::vector<vk::raii::CommandBuffer> MComputeCommandBuffers;
 
-  vk::raii::Semaphore MSemaphore = nullptr;
-  uint64_t MTimelineValue = 0;
+  /// @brief Pools of begin/end timestamp pairs, for each simulation state and
+  /// each frame in flight respectively.
+  vk::raii::QueryPool MComputeQueryPool = nullptr;
+  vk::raii::QueryPool MGraphicsQueryPool = nullptr;
+  /// @brief Pool of begin/end timestamp pairs around the grid build of each
+  /// simulation state, only created for `ComputeKernel::Collide`.
+  vk::raii::QueryPool MGridQueryPool = nullptr;
+  /// @brief Pool of timestamps before and after each stage of each
+  /// simulation state, only created if `usesStageTimes()`.
+  vk::raii::QueryPool MStageQueryPool = nullptr;
+  /// @brief Nanoseconds per timestamp tick, zero if timestamps unsupported.
+  float MTimestampPeriod = 0.0f;
+  uint64_t MTimestampMask = 0;
+  /// @brief GPU time of the last rendered frame in milliseconds, written by
+  /// the render thread and read by the simulation thread.
+  std::atomic<double> MRenderTime = 0.0;
+
+  vk::raii::Semaphore MComputeSemaphore = nullptr;
+  uint64_t MComputeTimelineValue = 0;
+  vk::raii::Semaphore MGraphicsSemaphore = nullptr;
+  uint64_t MGraphicsTimelineValue = 0;
   std::vector<vk::raii::Fence> MInFlightFences;
   uint32_t MCurrentFrame = 0;
 
-  double MLastFrameTime = 0.0;
-  double MLastTime = 0.0;
+  /// @brief Synchronization state of each buffer in `MShaderStorageBuffers`.
+  std::vector<SimulationState> MSimulationStates;
+  /// @brief Mailbox holding the index of the most recently completed state
+  /// and the compute timeline value it was signalled at, with
+  /// `SFreshStateBit` set if the renderer hasn't picked it up yet.
+  std::atomic<uint64_t> MLatestState = 0;
+  /// @brief Index of the state the renderer is currently drawing.
+  uint32_t MRenderState = 1;
+  /// @brief Compute timeline value of the state the renderer is drawing.
+  uint64_t MRenderStateValue = 0;
+
+  /// @brief Exception thrown on the simulation thread, rethrown by the render
+  /// thread once `MSimulationFailed` is set.
+  std::exception_ptr MSimulationError;
+  std::atomic<bool> MSimulationFailed = false;
 
   std::vector<const char *> MRequiredDeviceExtension = {
       vk::KHRSwapchainExtensionName,
@@ -191,10 +1401,138 @@ private:
    */
   static const uint32_t SWindowWidth = 800;
   static const uint32_t SWindowHeight = 600;
+  /// Frames the renderer records ahead. Only command buffers, fences and
+  /// timestamp queries are per frame, every frame in flight draws from the
+  /// state the renderer holds.
   static const unsigned SMaxFramesInFlight = 2;
+  /// Number of particle state buffers, one being written by the simulation,
+  /// one being read by the renderer, and the latest completed state.
+  /// Independent of `SMaxFramesInFlight`, as the simulation waits on the
+  /// graphics timeline value of the last draw from a state it takes back.
+  static const unsigned SSimulationStateCount = 3;
+  /// Layout of `MLatestState`, packing a state index and fresh bit below the
+  /// compute timeline value.
+  static constexpr uint64_t SStateIndexMask = 0x3;
+  static constexpr uint64_t SFreshStateBit = 0x4;
+  static constexpr unsigned SStateValueShift = 3;
   static const uint64_t SFenceTimeout = 100000000;
   static constexpr uint32_t SComputeWorkItems = 16;
   static constexpr uint32_t SComputeWorkGroups = 32;
+  /// Bounds of the number of active particles adjusted by `ParticleBudget`,
+  /// buffers are allocated up front for the maximum.
+  static constexpr uint32_t SMinParticleCount =
+      SComputeWorkItems * SComputeWorkGroups;
+  static constexpr uint32_t SMaxParticleCount = SMinParticleCount * 1024;
+  /// Minimum bytes of memory bound to each sparse particle state at a time.
+  static constexpr vk::DeviceSize SSparseChunkSize = 1 << 20;
+  /// Frame time in milliseconds that `ParticleBudget` aims to hold.
+  static constexpr double SFrameTimeTarget = 1000.0 / 60.0;
+  /// Number of timestep bins used by `ComputeKernel::MultiRate`, bin `k`
+  /// advances by `deltaTime / 2^k`. Must match `MultiRateLevels` in shader.
+  static constexpr uint32_t SMultiRateLevels = 4;
+  /// Strength of the harmonic force used by `SimulationMode::ForceField`,
+  /// giving an oscillation period of around 5 seconds.
+  static constexpr float SForceFieldStrength = 4e-7f;
+  /// Rate velocities relax at in `SimulationMode::Brownian`, per millisecond.
+  static constexpr float SBrownianDamping = 1e-3f;
+  /// Thermal energy of `SimulationMode::Brownian`, giving particles of unit
+  /// mass a root mean square speed along each axis of 2.5e-4.
+  static constexpr float SBrownianTemperature = 6.25e-8f;
+  /// Time step in milliseconds when `Options::seed` is set, rather than the
+  /// measured time of the last step.
+  static constexpr float SSeededDeltaTime = 1000.0f / 60.0f;
+  /// Particles in the block of clusters shape matched by each work-group.
+  /// Must match `ClusterBlockSize` in shader.
+  static constexpr uint32_t SClusterBlockSize = 256;
+  /// Smallest and largest particles in a cluster of
+  /// `SimulationMode::Clusters`, both powers of two.
+  static constexpr uint32_t SMinClusterSize = 16;
+  static constexpr uint32_t SMaxClusterSize = 128;
+  /// Stiffness of the soft clusters, every other cluster being rigid.
+  static constexpr float SSoftClusterStiffness = 0.1f;
+  /// Resolution of the thickness target of `Renderer::Surface`, half the
+  /// window's. Must match `SurfaceWidth` and `SurfaceHeight` in shader.
+  static constexpr uint32_t SSurfaceWidth = 400;
+  static constexpr uint32_t SSurfaceHeight = 300;
+  static constexpr uint32_t SSurfacePixels = SSurfaceWidth * SSurfaceHeight;
+  /// Number of work-groups launched by `ComputeKernel::Persistent`, and the
+  /// grid-stride and work queue `Schedule`, enough to occupy every compute
+  /// unit of a typical desktop GPU several times over as Vulkan doesn't
+  /// expose a portable compute unit count. Must match `PersistentWorkGroups`
+  /// in shader.
+  static constexpr uint32_t SPersistentWorkGroups = 512;
+  /// Fine cells of the grid used by `ComputeKernel::Collide`, 256x256 over
+  /// the window. Must match `GridCellCount` in shader.
+  static constexpr uint32_t SGridCellCount = 256 * 256;
+  /// Every this many grid builds is sorted from scratch while printing
+  /// statistics, as a reference to measure incremental builds against.
+  static constexpr uint32_t SGridReferenceInterval = 16;
+  /// Skin distance beyond the interaction radius, and most neighbours kept
+  /// per particle before it falls back to the grid, of
+  /// `Options::neighbourLists`. Must match `NeighbourSkin`
+  /// and `NeighbourCapacity` in shader.
+  static constexpr float SNeighbourSkin = 0.005f;
+  static constexpr uint32_t SNeighbourCapacity = 32;
+  /// Bins of each analytics histogram, the speed binned up to, and the pair
+  /// distance binned up to. Must match `AnalyticsBins`, `AnalyticsMaxSpeed`
+  /// and `AnalyticsMaxRadius` in shader.
+  static constexpr uint32_t SAnalyticsBins = 64;
+  static constexpr float SAnalyticsMaxSpeed = 0.001f;
+  static constexpr float SAnalyticsMaxRadius = 0.05f;
+  /// Cells along each side of the plasma grid, which has a node at each
+  /// cell corner. Must match `PlasmaGridCells` in shader.
+  static constexpr uint32_t SPlasmaGridCells = 128;
+  static constexpr uint32_t SPlasmaNodeCount =
+      (SPlasmaGridCells + 1) * (SPlasmaGridCells + 1);
+  /// Red-black sweep pairs of the potential solve each step, enough to
+  /// converge from the last step's potential.
+  static constexpr uint32_t SPlasmaSolveSweeps = 32;
+  /// Electron plasma frequency in radians per millisecond, an oscillation
+  /// period of around 1.6 seconds.
+  static constexpr float SPlasmaFrequency = 0.002f;
+  /// Magnetic field of `SimulationMode::MagnetisedPlasma`, giving electrons
+  /// a gyrofrequency of twice the plasma frequency.
+  static constexpr float SPlasmaMagneticField = 0.004f;
+  /// Mass of the ions relative to the electrons, reduced from a real
+  /// plasma so that ions still move visibly.
+  static constexpr float SPlasmaIonMass = 100.0f;
+  /// Cells along each side of the fluid grid, with a velocity on each cell
+  /// face. Must match `FluidGridCells` in shader.
+  static constexpr uint32_t SFluidGridCells = 128;
+  static constexpr uint32_t SFluidFaceCount =
+      SFluidGridCells * (SFluidGridCells + 1);
+  static constexpr uint32_t SFluidCellCount = SFluidGridCells * SFluidGridCells;
+  /// Speed limit of the velocity transferred to the fluid grid, and the
+  /// fixed point steps per unit velocity and unit weight it is summed in.
+  /// Must match `FluidMaxSpeed`, `FluidVelocityFixedPoint` and
+  /// `FluidWeightFixedPoint` in shader.
+  static constexpr float SFluidMaxSpeed = 0.002f;
+  static constexpr double SFluidVelocityFixedPoint = 1e6;
+  static constexpr double SFluidWeightFixedPoint = 2048.0;
+  // Every particle may land in the same cell, each adding up to its full
+  // weight and momentum to a face, plus half a step of rounding.
+  static_assert(SMaxParticleCount * (SFluidWeightFixedPoint + 0.5) <
+                    static_cast<double>(std::numeric_limits<int32_t>::max()),
+                "fluid face weights may overflow");
+  static_assert(SMaxParticleCount *
+                        (SFluidMaxSpeed * SFluidVelocityFixedPoint + 0.5) <
+                    static_cast<double>(std::numeric_limits<int32_t>::max()),
+                "fluid face momentum may overflow");
+  /// Jacobi iterations of the pressure solve each step, even so that the
+  /// result is left in the first copy, which the next solve starts from.
+  static constexpr uint32_t SFluidJacobiIterations = 64;
+  /// Level of the leaves of the fast multipole quadtree. Must match
+  /// `FmmLeafLevel` in shader.
+  static constexpr uint32_t SFmmLeafLevel = 7;
+  /// Cells of every level of the quadtree, down to the leaves.
+  static constexpr uint32_t SFmmCellCount =
+      ((1u << (2 * (SFmmLeafLevel + 1))) - 1) / 3;
+  /// Gravitational strength of all the particles together in
+  /// `ComputeKernel::Fmm`, split evenly between them.
+  static constexpr float SFmmGravity = 5e-8f;
+  /// Particles whose field is checked against all-pairs summation by the
+  /// benchmark.
+  static constexpr uint32_t SFmmSampleCount = 1024;
   static constexpr bool SEnableValidationLayers =
 #ifdef NDEBUG
       false;
@@ -202,8 +1540,58 @@ private:
       true;
 #endif
   static const std::vector<const char *> SValidationLayers;
+
+  /// @brief Thread running `simulationLoop()`, declared last so that it is
+  /// joined before any of the Vulkan objects it uses are destroyed.
+  std::jthread MSimulationThread;
 };
 
+/*
+ * Free functions from options.cpp
+ */
+
+/// @brief Parses the command-line arguments of the application.
+/// @param[in] argc Number of arguments.
+/// @param[in] argv Array of arguments, the first being the program name.
+/// @returns Options set from the arguments, throws on invalid arguments.
+Options parseOptions(int argc, char **argv);
+
+/*
+ * Free functions from buffer.cpp
+ */
+
+/// @brief Creates a buffer bound to newly allocated memory.
+/// @param[in] device Device to create the buffer on.
+/// @param[in] physicalDevice Physical device to find a memory type from.
+/// @param[in] size Bytes in buffer.
+/// @param[in] usage How the buffer will be used.
+/// @param[in] properties Required properties of the memory.
+/// @param[out] buffer Created buffer.
+/// @param[out] bufferMemory Memory bound to `buffer`.
+void createBuffer(vk::raii::Device &device,
+                  vk::raii::PhysicalDevice &physicalDevice, vk::DeviceSize size,
+                  vk::BufferUsageFlags usage,
+                  vk::MemoryPropertyFlags properties, vk::raii::Buffer &buffer,
+                  vk::raii::DeviceMemory &bufferMemory);
+
+/*
+ * Free functions from command_buffer.cpp
+ */
+
+/// @brief Inserts a global memory barrier between commands recorded before
+/// and after it.
+/// @param[in] commandBuffer Command-buffer to record barrier into.
+/// @param[in] srcStageMask Stages of earlier commands to wait on.
+/// @param[in] srcAccessMask Memory accesses of earlier commands to make
+/// available.
+/// @param[in] dstStageMask Stages of later commands that wait.
+/// @param[in] dstAccessMask Memory accesses of later commands to make visible.
+void memoryBarrier(vk::raii::CommandBuffer &commandBuffer,
+                   vk::PipelineStageFlags2 srcStageMask,
+                   vk::AccessFlags2 srcAccessMask,
+                   vk::PipelineStageFlags2 dstStageMask,
+                   vk::AccessFlags2 dstAccessMask);
+
 /*
  * Free functions from shader_file.cpp
  */
@@ -2,21 +2,49 @@
 
 #include "common.hpp"
 
+namespace {
+// Number of storage buffer bindings in the compute descriptor set layout,
+// following the uniform buffer at binding 0.
+constexpr uint32_t StorageBufferBindingCount = 45;
+} // anonymous namespace
+
 void vkParticle::createComputeDescriptorSetLayout() {
-  // The compute shader uses 3 descriptor sets:
-  // * `ConstantBuffer<UniformBuffer>`
-  // * `StructuredBuffer<ParticleSSBO>`
-  // * `RWStructuredBuffer<ParticleSSBO>`
-  std::array layoutBindings{
-      vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eUniformBuffer, 1,
-                                     vk::ShaderStageFlagBits::eCompute,
-                                     nullptr),
-      vk::DescriptorSetLayoutBinding(1, vk::DescriptorType::eStorageBuffer, 1,
-                                     vk::ShaderStageFlagBits::eCompute,
-                                     nullptr),
-      vk::DescriptorSetLayoutBinding(2, vk::DescriptorType::eStorageBuffer, 1,
-                                     vk::ShaderStageFlagBits::eCompute,
-                                     nullptr)};
+  // The compute shaders use the descriptor bindings:
+  // 0. `ConstantBuffer<UniformBuffer>`
+  // 1. `StructuredBuffer<ParticleSSBO>`
+  // 2. `RWStructuredBuffer<ParticleSSBO>`
+  // 3. `RWStructuredBuffer<uint>` multi-rate bin counts
+  // 4. `RWStructuredBuffer<uint>` multi-rate bin indices
+  // 5. `RWStructuredBuffer<uint>` multi-rate indirect dispatch arguments
+  // 6. `RWStructuredBuffer<ParticleSSBO>` fp32 reference state
+  // 7. `RWStructuredBuffer<uint>` precision error
+  // 8. `RWStructuredBuffer<uint>` persistent threads work queue
+  // 9. `RWStructuredBuffer<uint>` grid cell counts
+  // 10. `RWStructuredBuffer<uint>` grid cell starts
+  // 11. `RWStructuredBuffer<uint>` grid sorted particle indices
+  // 12. `RWStructuredBuffer<uint>` neighbour lists
+  // 13. `RWStructuredBuffer<uint>` neighbour counts
+  // 14. `RWStructuredBuffer<float2>` neighbour list origins
+  // 15. `RWStructuredBuffer<uint>` displacements since neighbour list build
+  // 16. `RWStructuredBuffer<uint>` grid sorted particle cells
+  // 17. `RWStructuredBuffer<uint>` grid previous sorted particle indices
+  // 18. `RWStructuredBuffer<uint>` grid previous sorted particle cells
+  // 19. `RWStructuredBuffer<uint>` grid stayed in cell flags
+  // 20. `RWStructuredBuffer<uint>` grid stayed in cell ranks
+  // 21. `RWStructuredBuffer<uint>` grid cell departure counts
+  // 22. `RWStructuredBuffer<uint>` grid cell departure starts
+  // 23. `RWStructuredBuffer<uint>` grid cell arrival starts
+  // 24. `RWStructuredBuffer<uint>` grid churn
+  // 25. `RWStructuredBuffer<SpatialQuery>` spatial queries
+  // 26. `RWStructuredBuffer<uint>` spatial query results
+  // Bindings only used by kernels that aren't enabled are left unwritten.
+  std::vector layoutBindings{vk::DescriptorSetLayoutBinding(
+      0, vk::DescriptorType::eUniformBuffer, 1,
+      vk::ShaderStageFlagBits::eCompute, nullptr)};
+  for (uint32_t binding = 1; binding <= StorageBufferBindingCount; binding++) {
+    layoutBindings.emplace_back(binding, vk::DescriptorType::eStorageBuffer, 1,
+                                vk::ShaderStageFlagBits::eCompute, nullptr);
+  }
 
   vk::DescriptorSetLayoutCreateInfo layoutInfo{
       .bindingCount = static_cast<uint32_t>(layoutBindings.size()),
@@ -26,81 +54,284 @@ void vkParticle::createComputeDescriptorSetLayout() {
 }
 
 void vkParticle::createDescriptorPool() {
-  // Every frame has 1 unfiorm buffer, and 2 storage buffers
-  std::array poolSize{vk::DescriptorPoolSize(vk::DescriptorType::eUniformBuffer,
-                                             SMaxFramesInFlight),
-                      vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer,
-                                             SMaxFramesInFlight * 2)};
+  // Every pair of input and output simulation states has 1 unfiorm buffer,
+  // and `StorageBufferBindingCount` storage buffers
+  constexpr uint32_t SetCount = SSimulationStateCount * SSimulationStateCount;
+  std::array poolSize{
+      vk::DescriptorPoolSize(vk::DescriptorType::eUniformBuffer, SetCount),
+      vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer,
+                             SetCount * StorageBufferBindingCount)};
 
   vk::DescriptorPoolCreateInfo poolInfo{};
   poolInfo.flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet;
-  poolInfo.maxSets = SMaxFramesInFlight;
+  poolInfo.maxSets = SetCount;
   poolInfo.poolSizeCount = poolSize.size();
   poolInfo.pPoolSizes = poolSize.data();
   MDescriptorPool = vk::raii::DescriptorPool(MDevice, poolInfo);
 }
 
 void vkParticle::createComputeDescriptorSets() {
-  std::vector<vk::DescriptorSetLayout> layouts(SMaxFramesInFlight,
+  // The simulation thread always reads from the state it last wrote, and
+  // writes to whichever state the renderer handed back, so allocate a set for
+  // every pair of states indexed by `inState * SSimulationStateCount +
+  // outState`. Sets where both states are the same are never bound.
+  constexpr uint32_t SetCount = SSimulationStateCount * SSimulationStateCount;
+  std::vector<vk::DescriptorSetLayout> layouts(SetCount,
                                                MComputeDescriptorSetLayout);
   vk::DescriptorSetAllocateInfo allocInfo{};
   allocInfo.descriptorPool = *MDescriptorPool;
-  allocInfo.descriptorSetCount = SMaxFramesInFlight;
+  allocInfo.descriptorSetCount = SetCount;
   allocInfo.pSetLayouts = layouts.data();
   MComputeDescriptorSets.clear();
   MComputeDescriptorSets = MDevice.allocateDescriptorSets(allocInfo);
 
-  // create descriptor sets for each frame in flight
-  for (size_t i = 0; i < SMaxFramesInFlight; i++) {
-    // Used for first descriptor to `ConstantBuffer<UniformBuffer>`,
-    // so link to the uniform buffer.
-    vk::DescriptorBufferInfo bufferInfo(MUniformBuffers[i], 0,
-                                        sizeof(UniformBufferObject));
-
-    // Create scratch GPU only memory for last frames details, so we know
-    // how to update with the current position based on last position
-    constexpr uint32_t ParticleCount = SComputeWorkItems * SComputeWorkGroups;
-    vk::DescriptorBufferInfo storageBufferInfoLastFrame(
-        MShaderStorageBuffers[(i - 1) % SMaxFramesInFlight], 0,
-        sizeof(Particle) * ParticleCount);
-
-    // Create scratch GPU only memory for current frames details
-    vk::DescriptorBufferInfo storageBufferInfoCurrentFrame(
-        MShaderStorageBuffers[i], 0, sizeof(Particle) * ParticleCount);
-
-    std::array descriptorWrites{
-        // Uniform buffer descriptor
-        vk::WriteDescriptorSet{.dstSet = *MComputeDescriptorSets[i],
-                               .dstBinding = 0,
-                               .dstArrayElement = 0,
-                               .descriptorCount = 1,
-                               .descriptorType =
-                                   vk::DescriptorType::eUniformBuffer,
-                               .pImageInfo = nullptr,
-                               .pBufferInfo = &bufferInfo,
-                               .pTexelBufferView = nullptr},
-
-        // Storage buffer descriptor, for last frame
-        vk::WriteDescriptorSet{.dstSet = *MComputeDescriptorSets[i],
-                               .dstBinding = 1,
-                               .dstArrayElement = 0,
-                               .descriptorCount = 1,
-                               .descriptorType =
-                                   vk::DescriptorType::eStorageBuffer,
-                               .pImageInfo = nullptr,
-                               .pBufferInfo = &storageBufferInfoLastFrame,
-                               .pTexelBufferView = nullptr},
-        // Storage buffer descriptor, for current frame
-        vk::WriteDescriptorSet{.dstSet = *MComputeDescriptorSets[i],
-                               .dstBinding = 2,
-                               .dstArrayElement = 0,
-                               .descriptorCount = 1,
-                               .descriptorType =
-                                   vk::DescriptorType::eStorageBuffer,
-                               .pImageInfo = nullptr,
-                               .pBufferInfo = &storageBufferInfoCurrentFrame,
-                               .pTexelBufferView = nullptr},
-    };
-    MDevice.updateDescriptorSets(descriptorWrites, {});
+  for (size_t inState = 0; inState < SSimulationStateCount; inState++) {
+    for (size_t outState = 0; outState < SSimulationStateCount; outState++) {
+      if (inState == outState) {
+        continue;
+      }
+      const vk::DescriptorSet descriptorSet =
+          *MComputeDescriptorSets[inState * SSimulationStateCount + outState];
+
+      // Buffer infos are pointed to by the writes, so reserve up front to
+      // avoid reallocation.
+      std::vector<vk::DescriptorBufferInfo> bufferInfos;
+      bufferInfos.reserve(1 + StorageBufferBindingCount);
+      std::vector<vk::WriteDescriptorSet> descriptorWrites;
+      auto addBuffer = [&](uint32_t binding, vk::DescriptorType type,
+                           vk::Buffer buffer, vk::DeviceSize range) {
+        bufferInfos.emplace_back(buffer, 0, range);
+        descriptorWrites.push_back(
+            vk::WriteDescriptorSet{.dstSet = descriptorSet,
+                                   .dstBinding = binding,
+                                   .dstArrayElement = 0,
+                                   .descriptorCount = 1,
+                                   .descriptorType = type,
+                                   .pImageInfo = nullptr,
+                                   .pBufferInfo = &bufferInfos.back(),
+                                   .pTexelBufferView = nullptr});
+      };
+
+      // Used for first descriptor to `ConstantBuffer<UniformBuffer>`,
+      // so link to the uniform buffer of the state being written.
+      addBuffer(0, vk::DescriptorType::eUniformBuffer,
+                MUniformBuffers[outState], sizeof(UniformBufferObject));
+
+      // GPU only memory for last steps details, so we know how to update with
+      // the current position based on last position
+      addBuffer(1, vk::DescriptorType::eStorageBuffer,
+                MShaderStorageBuffers[inState],
+                sizeof(Particle) * SMaxParticleCount);
+
+      // GPU only memory for current steps details
+      addBuffer(2, vk::DescriptorType::eStorageBuffer,
+                MShaderStorageBuffers[outState],
+                sizeof(Particle) * SMaxParticleCount);
+
+      // Timestep bins shared by all states
+      if (MOptions.kernel == ComputeKernel::MultiRate) {
+        addBuffer(3, vk::DescriptorType::eStorageBuffer, MMultiRateCountBuffer,
+                  vk::WholeSize);
+        addBuffer(4, vk::DescriptorType::eStorageBuffer, MMultiRateIndexBuffer,
+                  vk::WholeSize);
+        addBuffer(5, vk::DescriptorType::eStorageBuffer, MMultiRateArgsBuffer,
+                  vk::WholeSize);
+      }
+
+      // Reference state for measuring half precision error
+      if (MOptions.kernel == ComputeKernel::Half && MOptions.stats) {
+        addBuffer(6, vk::DescriptorType::eStorageBuffer, MReferenceBuffer,
+                  vk::WholeSize);
+        addBuffer(7, vk::DescriptorType::eStorageBuffer, MPrecisionErrorBuffer,
+                  vk::WholeSize);
+      }
+
+      // Work queue of persistent threads
+      if (usesWorkQueue()) {
+        addBuffer(8, vk::DescriptorType::eStorageBuffer, MWorkQueueBuffer,
+                  vk::WholeSize);
+      }
+
+      // Two level grid of the collide kernel, spatial queries and analytics
+      if (usesGrid()) {
+        addBuffer(9, vk::DescriptorType::eStorageBuffer, MGridCellCountBuffer,
+                  vk::WholeSize);
+        addBuffer(10, vk::DescriptorType::eStorageBuffer, MGridCellStartBuffer,
+                  vk::WholeSize);
+        addBuffer(11, vk::DescriptorType::eStorageBuffer, MGridSortedBuffer,
+                  vk::WholeSize);
+        addBuffer(16, vk::DescriptorType::eStorageBuffer,
+                  MGridSortedCellBuffer, vk::WholeSize);
+      }
+
+      // Incremental grid builds of the collide kernel
+      if (MOptions.gridChurnThreshold > 0) {
+        addBuffer(17, vk::DescriptorType::eStorageBuffer, MGridSlotIndexBuffer,
+                  vk::WholeSize);
+        addBuffer(18, vk::DescriptorType::eStorageBuffer, MGridSlotCellBuffer,
+                  vk::WholeSize);
+        addBuffer(19, vk::DescriptorType::eStorageBuffer, MGridStayFlagBuffer,
+                  vk::WholeSize);
+        addBuffer(20, vk::DescriptorType::eStorageBuffer, MGridStayRankBuffer,
+                  vk::WholeSize);
+        addBuffer(21, vk::DescriptorType::eStorageBuffer,
+                  MGridDepartureCountBuffer, vk::WholeSize);
+        addBuffer(22, vk::DescriptorType::eStorageBuffer,
+                  MGridDepartureStartBuffer, vk::WholeSize);
+        addBuffer(23, vk::DescriptorType::eStorageBuffer,
+                  MGridArrivalStartBuffer, vk::WholeSize);
+        addBuffer(24, vk::DescriptorType::eStorageBuffer, MGridChurnBuffer,
+                  vk::WholeSize);
+      }
+
+      // Verlet neighbour lists of the collide kernel
+      if (MOptions.neighbourLists) {
+        addBuffer(12, vk::DescriptorType::eStorageBuffer, MNeighbourListBuffer,
+                  vk::WholeSize);
+        addBuffer(13, vk::DescriptorType::eStorageBuffer,
+                  MNeighbourCountBuffer, vk::WholeSize);
+        addBuffer(14, vk::DescriptorType::eStorageBuffer,
+                  MNeighbourOriginBuffer, vk::WholeSize);
+        addBuffer(15, vk::DescriptorType::eStorageBuffer,
+                  MNeighbourDisplacementBuffer, vk::WholeSize);
+      }
+
+      // Batched spatial queries
+      if (MOptions.spatialQueries) {
+        addBuffer(25, vk::DescriptorType::eStorageBuffer, MSpatialQueryBuffer,
+                  vk::WholeSize);
+        addBuffer(26, vk::DescriptorType::eStorageBuffer,
+                  MSpatialResultBuffer, vk::WholeSize);
+      }
+
+      // Histograms of GPU analytics
+      if (!MOptions.analyticsFile.empty()) {
+        addBuffer(27, vk::DescriptorType::eStorageBuffer, MAnalyticsBuffer,
+                  vk::WholeSize);
+      }
+
+      // Particle-in-cell grids of the plasma modes
+      if (usesPlasma()) {
+        addBuffer(28, vk::DescriptorType::eStorageBuffer, MPlasmaChargeBuffer,
+                  vk::WholeSize);
+        addBuffer(29, vk::DescriptorType::eStorageBuffer,
+                  MPlasmaPotentialBuffer, vk::WholeSize);
+        addBuffer(30, vk::DescriptorType::eStorageBuffer, MPlasmaFieldBuffer,
+                  vk::WholeSize);
+      }
+
+      // Expansions and fields of the fast multipole method
+      if (MOptions.kernel == ComputeKernel::Fmm) {
+        addBuffer(31, vk::DescriptorType::eStorageBuffer,
+                  MFmmMultipoleBuffer, vk::WholeSize);
+        addBuffer(32, vk::DescriptorType::eStorageBuffer, MFmmLocalBuffer,
+                  vk::WholeSize);
+        addBuffer(33, vk::DescriptorType::eStorageBuffer, MFmmFieldBuffer,
+                  vk::WholeSize);
+      }
+      if (MOptions.benchmarkFmm) {
+        addBuffer(34, vk::DescriptorType::eStorageBuffer,
+                  MFmmReferenceBuffer, vk::WholeSize);
+      }
+
+      // Marker-and-cell grid of the fluid mode
+      if (MOptions.mode == SimulationMode::Fluid) {
+        addBuffer(35, vk::DescriptorType::eStorageBuffer,
+                  MFluidMomentumBuffer, vk::WholeSize);
+        addBuffer(36, vk::DescriptorType::eStorageBuffer, MFluidWeightBuffer,
+                  vk::WholeSize);
+        addBuffer(37, vk::DescriptorType::eStorageBuffer,
+                  MFluidVelocityBuffer, vk::WholeSize);
+        addBuffer(38, vk::DescriptorType::eStorageBuffer,
+                  MFluidSavedVelocityBuffer, vk::WholeSize);
+        addBuffer(39, vk::DescriptorType::eStorageBuffer,
+                  MFluidCellCountBuffer, vk::WholeSize);
+        addBuffer(40, vk::DescriptorType::eStorageBuffer,
+                  MFluidDivergenceBuffer, vk::WholeSize);
+        addBuffer(41, vk::DescriptorType::eStorageBuffer,
+                  MFluidPressureBuffer, vk::WholeSize);
+      }
+
+      // Ranges and rest shapes of shape matching clusters
+      if (MOptions.mode == SimulationMode::Clusters) {
+        addBuffer(42, vk::DescriptorType::eStorageBuffer, MClusterRangeBuffer,
+                  vk::WholeSize);
+        addBuffer(43, vk::DescriptorType::eStorageBuffer,
+                  MClusterMemberBuffer, vk::WholeSize);
+      }
+
+      // Compact stream of the state being written, drawn by the graphics
+      // pipeline
+      if (usesRenderStream()) {
+        addBuffer(44, vk::DescriptorType::eStorageBuffer,
+                  MRenderStreamBuffers[outState], vk::WholeSize);
+      }
+
+      // Particles injected from the host
+      if (MOptions.injection) {
+        addBuffer(45, vk::DescriptorType::eStorageBuffer, MSpawnRingBuffer,
+                  vk::WholeSize);
+      }
+
+      MDevice.updateDescriptorSets(descriptorWrites, {});
+    }
+  }
+}
+
+void vkParticle::createSplatDescriptorSets() {
+  // Any state may be drawn into any swapchain image, so allocate a set for
+  // every pair, from a pool which is recreated along with the swapchain.
+  const uint32_t setCount = static_cast<uint32_t>(SSimulationStateCount *
+                                                  MSwapChainImageViews.size());
+  std::array poolSize{
+      vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer, setCount),
+      vk::DescriptorPoolSize(vk::DescriptorType::eStorageImage, setCount)};
+  vk::DescriptorPoolCreateInfo poolInfo{};
+  poolInfo.flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet;
+  poolInfo.maxSets = setCount;
+  poolInfo.poolSizeCount = poolSize.size();
+  poolInfo.pPoolSizes = poolSize.data();
+  MSplatDescriptorSets.clear();
+  MSplatDescriptorPool = vk::raii::DescriptorPool(MDevice, poolInfo);
+
+  std::vector<vk::DescriptorSetLayout> layouts(setCount,
+                                               MSplatDescriptorSetLayout);
+  vk::DescriptorSetAllocateInfo allocInfo{};
+  allocInfo.descriptorPool = *MSplatDescriptorPool;
+  allocInfo.descriptorSetCount = setCount;
+  allocInfo.pSetLayouts = layouts.data();
+  MSplatDescriptorSets = MDevice.allocateDescriptorSets(allocInfo);
+
+  for (size_t state = 0; state < SSimulationStateCount; state++) {
+    for (size_t image = 0; image < MSwapChainImageViews.size(); image++) {
+      const vk::DescriptorSet descriptorSet =
+          *MSplatDescriptorSets[state * MSwapChainImageViews.size() + image];
+      vk::DescriptorBufferInfo bufferInfo(MShaderStorageBuffers[state], 0,
+                                          sizeof(Particle) *
+                                              SMaxParticleCount);
+      // Storage images are accessed in the general layout
+      vk::DescriptorImageInfo imageInfo(nullptr, MSwapChainImageViews[image],
+                                        vk::ImageLayout::eGeneral);
+      std::array descriptorWrites{
+          vk::WriteDescriptorSet{
+              .dstSet = descriptorSet,
+              .dstBinding = 0,
+              .dstArrayElement = 0,
+              .descriptorCount = 1,
+              .descriptorType = vk::DescriptorType::eStorageBuffer,
+              .pImageInfo = nullptr,
+              .pBufferInfo = &bufferInfo,
+              .pTexelBufferView = nullptr},
+          vk::WriteDescriptorSet{
+              .dstSet = descriptorSet,
+              .dstBinding = 1,
+              .dstArrayElement = 0,
+              .descriptorCount = 1,
+              .descriptorType = vk::DescriptorType::eStorageImage,
+              .pImageInfo = &imageInfo,
+              .pBufferInfo = nullptr,
+              .pTexelBufferView = nullptr}};
+      MDevice.updateDescriptorSets(descriptorWrites, {});
+    }
   }
 }
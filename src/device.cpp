@@ -5,6 +5,12 @@
 #include <stdexcept>
 
 void vkParticle::pickPhysicalDevice() {
+  // Only the primitives push their descriptors, so devices without push
+  // descriptors can run everything else.
+  if (usesPrimitives()) {
+    MRequiredDeviceExtension.push_back(vk::KHRPushDescriptorExtensionName);
+  }
+
   std::vector<vk::raii::PhysicalDevice> devices =
       MInstance.enumeratePhysicalDevices();
   const auto devIter = std::ranges::find_if(devices, [&](auto const &device) {
@@ -59,6 +65,50 @@ void vkParticle::pickPhysicalDevice() {
   } else {
     throw std::runtime_error("failed to find a suitable GPU!");
   }
+
+  // Check for optional features, which only some compute kernels and
+  // renderers require.
+  auto optionalFeatures = MPhysicalDevice.template getFeatures2<
+      vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan11Features,
+      vk::PhysicalDeviceVulkan12Features>();
+  MSupportsStorageWriteWithoutFormat =
+      optionalFeatures.template get<vk::PhysicalDeviceFeatures2>()
+          .features.shaderStorageImageWriteWithoutFormat;
+  MSupportsFloat16 =
+      optionalFeatures.template get<vk::PhysicalDeviceVulkan12Features>()
+          .shaderFloat16 &&
+      optionalFeatures.template get<vk::PhysicalDeviceVulkan11Features>()
+          .storageBuffer16BitAccess;
+  // Sparse residency lets the particle states grow without reallocating,
+  // otherwise their full capacity is allocated up front. The FMM benchmark
+  // sweeps up to the full capacity without stepping, so it never commits.
+  MSparseStorage =
+      !MOptions.benchmarkFmm &&
+      optionalFeatures.template get<vk::PhysicalDeviceFeatures2>()
+          .features.sparseBinding &&
+      optionalFeatures.template get<vk::PhysicalDeviceFeatures2>()
+          .features.sparseResidencyBuffer;
+  // Importing host memory lets the initial particles be uploaded straight
+  // from where they were generated or mapped from a file.
+  MSupportsHostImport = std::ranges::any_of(
+      MPhysicalDevice.enumerateDeviceExtensionProperties(),
+      [](auto const &extension) {
+        return strcmp(extension.extensionName,
+                      vk::EXTExternalMemoryHostExtensionName) == 0;
+      });
+  if (MSupportsHostImport) {
+    auto properties = MPhysicalDevice.template getProperties2<
+        vk::PhysicalDeviceProperties2,
+        vk::PhysicalDeviceExternalMemoryHostPropertiesEXT>();
+    MHostImportAlignment =
+        properties
+            .template get<vk::PhysicalDeviceExternalMemoryHostPropertiesEXT>()
+            .minImportedHostPointerAlignment;
+  }
+  if (MOptions.kernel == ComputeKernel::Half && !MSupportsFloat16) {
+    throw std::runtime_error(
+        "half kernel requires shaderFloat16 and 16-bit storage support!");
+  }
 }
 
 void vkParticle::createLogicalDevice() {
@@ -82,37 +132,70 @@ void vkParticle::createLogicalDevice() {
     throw std::runtime_error(
         "Could not find a queue for graphics and present -> terminating");
   }
+  // Memory is bound by the simulation thread on its queue
+  MSparseStorage = MSparseStorage &&
+                   (queueFamilyProperties[MQueueIndex].queueFlags &
+                    vk::QueueFlagBits::eSparseBinding);
 
   // Setup pointer chain of structs with required features to create logical
-  // device with.
+  // device with. Timeline semaphores are enabled through the Vulkan 1.2
+  // features, as the struct for the individual feature can't be chained
+  // alongside it. Half precision features, and writing storage images without
+  // a format for the compute renderer, and sparse binding for growable
+  // particle storage, are enabled when supported.
   vk::StructureChain<vk::PhysicalDeviceFeatures2,
+                     vk::PhysicalDeviceVulkan11Features,
+                     vk::PhysicalDeviceVulkan12Features,
                      vk::PhysicalDeviceVulkan13Features,
-                     vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT,
-                     vk::PhysicalDeviceTimelineSemaphoreFeaturesKHR>
+                     vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT>
       featureChain = {
-          {}, // vk::PhysicalDeviceFeatures2
+          {.features = {.shaderStorageImageWriteWithoutFormat =
+                            MSupportsStorageWriteWithoutFormat,
+                        .sparseBinding = MSparseStorage,
+                        .sparseResidencyBuffer =
+                            MSparseStorage}}, // Features2
+          {.storageBuffer16BitAccess =
+               MSupportsFloat16}, // vk::PhysicalDeviceVulkan11Features
+          {.shaderFloat16 = MSupportsFloat16,
+           .timelineSemaphore = true}, // vk::PhysicalDeviceVulkan12Features
           {.synchronization2 = true,
            .dynamicRendering = true,
            .maintenance4 = true}, // vk::PhysicalDeviceVulkan13Features
           {.extendedDynamicState =
-               true}, // vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT
-          {.timelineSemaphore = true} // vk::PhysicalDeviceTimelineSemaphoreKHR
+               true} // vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT
       };
 
-  // create a logical device and queue
-  float queuePriority = 0.0f;
+  // create a logical device and queues. A second queue from the family is
+  // used by the simulation thread when available, so that compute submissions
+  // don't need to be synchronized with graphics submission and presentation.
+  uint32_t queueCount =
+      std::min(2u, queueFamilyProperties[MQueueIndex].queueCount);
+  std::array queuePriorities{0.0f, 0.0f};
   vk::DeviceQueueCreateInfo deviceQueueCreateInfo{
       .queueFamilyIndex = MQueueIndex,
-      .queueCount = 1,
-      .pQueuePriorities = &queuePriority};
+      .queueCount = queueCount,
+      .pQueuePriorities = queuePriorities.data()};
+  std::vector<const char *> deviceExtensions = MRequiredDeviceExtension;
+  if (MSupportsHostImport) {
+    deviceExtensions.push_back(vk::EXTExternalMemoryHostExtensionName);
+  }
   vk::DeviceCreateInfo deviceCreateInfo{
       .pNext = &featureChain.get<vk::PhysicalDeviceFeatures2>(),
       .queueCreateInfoCount = 1,
       .pQueueCreateInfos = &deviceQueueCreateInfo,
-      .enabledExtensionCount =
-          static_cast<uint32_t>(MRequiredDeviceExtension.size()),
-      .ppEnabledExtensionNames = MRequiredDeviceExtension.data()};
+      .enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size()),
+      .ppEnabledExtensionNames = deviceExtensions.data()};
 
   MDevice = vk::raii::Device(MPhysicalDevice, deviceCreateInfo);
   MQueue = vk::raii::Queue(MDevice, MQueueIndex, 0);
+  MComputeQueue = vk::raii::Queue(MDevice, MQueueIndex, queueCount - 1);
+  MComputeQueueShared = queueCount < 2;
+}
+
+std::unique_lock<std::mutex> vkParticle::lockSharedQueue() {
+  std::unique_lock lock(MQueueMutex, std::defer_lock);
+  if (MComputeQueueShared) {
+    lock.lock();
+  }
+  return lock;
 }
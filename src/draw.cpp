@@ -16,46 +16,26 @@ void vkParticle::drawFrame() {
   // Reset fence back to unsignalled state after it has been signalled.
   MDevice.resetFences(*MInFlightFences[MCurrentFrame]);
 
-  // Update timeline value for this frame such that the graphics pipeline
-  // waits on the compute pipeline to finish, rather than being async.
-  uint64_t computeWaitValue = MTimelineValue;
-  uint64_t computeSignalValue = ++MTimelineValue;
-  uint64_t graphicsWaitValue = computeSignalValue;
-  uint64_t graphicsSignalValue = ++MTimelineValue;
-
-  // Update uniform buffer with delta time
-  updateUniformBuffer(MCurrentFrame);
-
-  // Submit compute work to device
-  {
-    // Setup compute command-buffer with commands.
-    recordComputeCommandBuffer();
+  // Pick up the most recently completed simulation state if there is a new
+  // one, handing back the state we were drawing along with the graphics
+  // timeline value of the last draw that read from it. Nothing is waited on
+  // here, so a slow simulation step never delays presentation.
+  if (MLatestState.load(std::memory_order_relaxed) & SFreshStateBit) {
+    MSimulationStates[MRenderState].graphicsValue = MGraphicsTimelineValue;
+    uint64_t latest =
+        MLatestState.exchange(MRenderState, std::memory_order_acq_rel);
+    MRenderState = static_cast<uint32_t>(latest & SStateIndexMask);
+    MRenderStateValue = latest >> SStateValueShift;
+  }
 
-    // Set timeline semaphore values
-    vk::TimelineSemaphoreSubmitInfo computeTimelineInfo{
-        .waitSemaphoreValueCount = 1,
-        .pWaitSemaphoreValues = &computeWaitValue,
-        .signalSemaphoreValueCount = 1,
-        .pSignalSemaphoreValues = &computeSignalValue};
+  // Graphics pipeline waits on the compute step that wrote the state being
+  // drawn, which has already completed.
+  uint64_t graphicsWaitValue = MRenderStateValue;
+  uint64_t graphicsSignalValue = ++MGraphicsTimelineValue;
 
-    // Which stage of the pipeline to wait on for semaphores
-    vk::PipelineStageFlags waitStages[] = {
-        vk::PipelineStageFlagBits::eComputeShader};
-    // Submit command-buffer to queue
-    vk::SubmitInfo computeSubmitInfo{
-        .pNext = &computeTimelineInfo,
-        .waitSemaphoreCount = 1,
-        .pWaitSemaphores = &*MSemaphore,
-        .pWaitDstStageMask = waitStages,
-        .commandBufferCount = 1,
-        .pCommandBuffers = &*MComputeCommandBuffers[MCurrentFrame],
-        .signalSemaphoreCount = 1,
-        .pSignalSemaphores = &*MSemaphore};
-    MQueue.submit(computeSubmitInfo, nullptr);
-  }
   // Submit graphics work to device
   {
-    // Setup compute command-buffer with commands.
+    // Setup graphics command-buffer with commands.
     recordGraphicsCommandBuffer(imageIndex);
 
     // Submit graphics work, waits for compute to finish.
@@ -65,30 +45,47 @@ void vkParticle::drawFrame() {
         .signalSemaphoreValueCount = 1,
         .pSignalSemaphoreValues = &graphicsSignalValue};
 
-    // Wait at vertex input stage for compute to finish
-    vk::PipelineStageFlags waitStage = vk::PipelineStageFlagBits::eVertexInput;
+    // Wait at vertex input stage for compute to finish, or the compute
+    // shader stage when particles are splatted rather than drawn.
+    vk::PipelineStageFlags waitStage =
+        MComputePresent || MOptions.renderer == Renderer::Surface
+            ? vk::PipelineStageFlagBits::eComputeShader
+            : vk::PipelineStageFlagBits::eVertexInput;
 
     // Submit command-buffer to queue
     vk::SubmitInfo graphicsSubmitInfo{
         .pNext = &graphicsTimelineInfo,
         .waitSemaphoreCount = 1,
-        .pWaitSemaphores = &*MSemaphore,
+        .pWaitSemaphores = &*MComputeSemaphore,
         .pWaitDstStageMask = &waitStage,
         .commandBufferCount = 1,
         .pCommandBuffers = &*MGraphicsCommandBuffers[MCurrentFrame],
         .signalSemaphoreCount = 1,
-        .pSignalSemaphores = &*MSemaphore};
-    MQueue.submit(graphicsSubmitInfo, nullptr);
+        .pSignalSemaphores = &*MGraphicsSemaphore};
+    {
+      // Only need to serialize with the simulation thread if there is a
+      // single queue
+      auto lock = lockSharedQueue();
+      MQueue.submit(graphicsSubmitInfo, nullptr);
+    }
 
     // Present the image (wait for graphics to finish)
     vk::SemaphoreWaitInfo waitInfo{.semaphoreCount = 1,
-                                   .pSemaphores = &*MSemaphore,
+                                   .pSemaphores = &*MGraphicsSemaphore,
                                    .pValues = &graphicsSignalValue};
 
     // Wait for graphics to complete before presenting rendered frame
     while (vk::Result::eTimeout == MDevice.waitSemaphores(waitInfo, UINT64_MAX))
       ;
 
+    // Graphics has completed, so make its GPU time available to the
+    // simulation thread's particle budget.
+    if (MTimestampPeriod > 0.0f) {
+      MRenderTime.store(
+          readTimestampQueries(MGraphicsQueryPool, MCurrentFrame * 2),
+          std::memory_order_relaxed);
+    }
+
     // Before an application can display an image it's format must
     // be transitioned to an appropriate layout.
     vk::PresentInfoKHR presentInfo{.waitSemaphoreCount = 0,
@@ -96,7 +93,10 @@ void vkParticle::drawFrame() {
                                    .swapchainCount = 1,
                                    .pSwapchains = &*MSwapChain,
                                    .pImageIndices = &imageIndex};
-    result = MQueue.presentKHR(presentInfo);
+    {
+      auto lock = lockSharedQueue();
+      result = MQueue.presentKHR(presentInfo);
+    }
     if (result == vk::Result::eErrorOutOfDateKHR ||
         result == vk::Result::eSuboptimalKHR || MFramebufferResized) {
       MFramebufferResized = false;
@@ -0,0 +1,80 @@
+// Copyright (c) 2025-2026 Ewan Crawford
+
+#include "common.hpp"
+
+void vkParticle::recordFluidCommands(vk::raii::CommandBuffer &commandBuffer,
+                                     uint32_t outState,
+                                     uint32_t particleCount) {
+  uint32_t stage = 0;
+  writeStageTimestamp(commandBuffer, outState, stage);
+  auto endStage = [&] {
+    writeStageTimestamp(commandBuffer, outState, ++stage);
+  };
+  auto computeBarrier = [&] {
+    memoryBarrier(commandBuffer, vk::PipelineStageFlagBits2::eComputeShader,
+                  vk::AccessFlagBits2::eShaderStorageWrite,
+                  vk::PipelineStageFlagBits2::eComputeShader,
+                  vk::AccessFlagBits2::eShaderStorageRead |
+                      vk::AccessFlagBits2::eShaderStorageWrite);
+  };
+  uint32_t particleGroups =
+      (particleCount + SComputeWorkItems - 1) / SComputeWorkItems;
+  uint32_t faceGroups =
+      (2 * SFluidFaceCount + SComputeWorkItems - 1) / SComputeWorkItems;
+  uint32_t cellGroups =
+      (SFluidCellCount + SComputeWorkItems - 1) / SComputeWorkItems;
+
+  // Transfer accumulates with atomics, so start from zero. The pressure is
+  // only cleared before the first solve, later solves start from the last.
+  commandBuffer.fillBuffer(MFluidMomentumBuffer, 0, vk::WholeSize, 0);
+  commandBuffer.fillBuffer(MFluidWeightBuffer, 0, vk::WholeSize, 0);
+  commandBuffer.fillBuffer(MFluidCellCountBuffer, 0, vk::WholeSize, 0);
+  if (!MFluidPressureCleared) {
+    commandBuffer.fillBuffer(MFluidPressureBuffer, 0, vk::WholeSize, 0);
+    MFluidPressureCleared = true;
+  }
+  memoryBarrier(commandBuffer, vk::PipelineStageFlagBits2::eTransfer,
+                vk::AccessFlagBits2::eTransferWrite,
+                vk::PipelineStageFlagBits2::eComputeShader,
+                vk::AccessFlagBits2::eShaderStorageRead |
+                    vk::AccessFlagBits2::eShaderStorageWrite);
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             MFluidTransferPipeline);
+  commandBuffer.dispatch(particleGroups, 1, 1);
+  computeBarrier();
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             MFluidNormalisePipeline);
+  commandBuffer.dispatch(faceGroups, 1, 1);
+  computeBarrier();
+  endStage();
+
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             MFluidDivergencePipeline);
+  commandBuffer.dispatch(cellGroups, 1, 1);
+  computeBarrier();
+  // Each iteration reads one copy of the pressure and writes the other
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             MFluidJacobiPipeline);
+  for (uint32_t iteration = 0; iteration < SFluidJacobiIterations;
+       iteration++) {
+    ComputePushConstants pushConstants{.sweep = iteration % 2};
+    commandBuffer.pushConstants<ComputePushConstants>(
+        MComputePipelineLayout, vk::ShaderStageFlagBits::eCompute, 0,
+        pushConstants);
+    commandBuffer.dispatch(cellGroups, 1, 1);
+    computeBarrier();
+  }
+  endStage();
+
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             MFluidProjectPipeline);
+  commandBuffer.dispatch(faceGroups, 1, 1);
+  computeBarrier();
+  endStage();
+
+  // Gathers the grid velocity and moves the particles into the output state
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             MFluidGatherPipeline);
+  commandBuffer.dispatch(particleGroups, 1, 1);
+  endStage();
+}
@@ -0,0 +1,196 @@
+// Copyright (c) 2025-2026 Ewan Crawford
+
+#include "common.hpp"
+#include <algorithm>
+#include <cmath>
+#include <format>
+#include <iostream>
+
+void vkParticle::recordFmmCommands(vk::raii::CommandBuffer &commandBuffer,
+                                   uint32_t inState, uint32_t outState,
+                                   uint32_t particleCount) {
+  // Quadtree of the state being read, whose leaves group contiguous fine
+  // cells of the grid.
+  recordGridRebuildCommands(commandBuffer, inState, outState, particleCount);
+
+  auto computeBarrier = [&] {
+    memoryBarrier(commandBuffer, vk::PipelineStageFlagBits2::eComputeShader,
+                  vk::AccessFlagBits2::eShaderStorageWrite,
+                  vk::PipelineStageFlagBits2::eComputeShader,
+                  vk::AccessFlagBits2::eShaderStorageRead |
+                      vk::AccessFlagBits2::eShaderStorageWrite);
+  };
+  // Dispatches an invocation per cell of a level
+  auto dispatchLevel = [&](uint32_t level) {
+    uint32_t cells = 1u << (2 * level);
+    commandBuffer.dispatch((cells + SComputeWorkItems - 1) / SComputeWorkItems,
+                           1, 1);
+  };
+  auto pushLevel = [&](uint32_t level) {
+    ComputePushConstants pushConstants{.level = level};
+    commandBuffer.pushConstants<ComputePushConstants>(
+        MComputePipelineLayout, vk::ShaderStageFlagBits::eCompute, 0,
+        pushConstants);
+  };
+
+  // Upward pass, multipoles of the leaves then of each level above. Cells
+  // of levels 0 and 1 neighbour every other cell, so never interact
+  // through their multipoles.
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             MFmmMultipolePipeline);
+  dispatchLevel(SFmmLeafLevel);
+  computeBarrier();
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             MFmmUpwardPipeline);
+  for (uint32_t level = SFmmLeafLevel - 1; level >= 2; level--) {
+    pushLevel(level);
+    dispatchLevel(level);
+    computeBarrier();
+  }
+
+  // Interaction lists of every level only read multipoles, so are converted
+  // to locals by a single dispatch.
+  constexpr uint32_t InteractingCells = SFmmCellCount - 5;
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             MFmmInteractPipeline);
+  commandBuffer.dispatch(
+      (InteractingCells + SComputeWorkItems - 1) / SComputeWorkItems, 1, 1);
+  computeBarrier();
+
+  // Downward pass, each level adding the locals of the level above
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             MFmmDownwardPipeline);
+  for (uint32_t level = 3; level <= SFmmLeafLevel; level++) {
+    pushLevel(level);
+    dispatchLevel(level);
+    computeBarrier();
+  }
+
+  // A work-group per leaf evaluates the far and near field of its particles
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             MFmmNearPipeline);
+  commandBuffer.dispatch(1u << (2 * SFmmLeafLevel), 1, 1);
+}
+
+void vkParticle::benchmarkFmm() {
+  // Timestamps bracket each run
+  vk::QueryPoolCreateInfo queryInfo{.queryType = vk::QueryType::eTimestamp,
+                                    .queryCount = 2};
+  vk::raii::QueryPool queryPool(MDevice, queryInfo);
+
+  // Fields of the sampled particles copied out of the step
+  constexpr vk::DeviceSize SampleBufferSize =
+      sizeof(glm::vec2) * SFmmSampleCount;
+  vk::raii::Buffer sampleBuffer({});
+  vk::raii::DeviceMemory sampleBufferMemory({});
+  createBuffer(MDevice, MPhysicalDevice, SampleBufferSize,
+               vk::BufferUsageFlagBits::eTransferDst,
+               vk::MemoryPropertyFlagBits::eHostVisible |
+                   vk::MemoryPropertyFlagBits::eHostCoherent,
+               sampleBuffer, sampleBufferMemory);
+  auto sampleFields = static_cast<glm::vec2 *>(
+      sampleBufferMemory.mapMemory(0, SampleBufferSize));
+
+  // Reads the initial particles without advancing them
+  constexpr uint32_t InState = 0;
+  constexpr uint32_t OutState = 1;
+
+  // Records commands into a single-submit command-buffer with the step's
+  // descriptors bound, waiting for them to complete and returning their GPU
+  // time in milliseconds.
+  auto run = [&](auto record) {
+    vk::CommandBufferAllocateInfo allocInfo{
+        .commandPool = MCommandPool,
+        .level = vk::CommandBufferLevel::ePrimary,
+        .commandBufferCount = 1};
+    vk::raii::CommandBuffer commandBuffer =
+        std::move(MDevice.allocateCommandBuffers(allocInfo).front());
+    commandBuffer.begin(vk::CommandBufferBeginInfo{
+        .flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+    commandBuffer.bindDescriptorSets(
+        vk::PipelineBindPoint::eCompute, MComputePipelineLayout, 0,
+        {MComputeDescriptorSets[InState * SSimulationStateCount + OutState]},
+        {});
+    if (MTimestampPeriod > 0.0f) {
+      commandBuffer.resetQueryPool(queryPool, 0, 2);
+      commandBuffer.writeTimestamp2(vk::PipelineStageFlagBits2::eTopOfPipe,
+                                    queryPool, 0);
+    }
+    record(commandBuffer);
+    if (MTimestampPeriod > 0.0f) {
+      commandBuffer.writeTimestamp2(vk::PipelineStageFlagBits2::eAllCommands,
+                                    queryPool, 1);
+    }
+    // Make results visible to the host
+    memoryBarrier(commandBuffer,
+                  vk::PipelineStageFlagBits2::eComputeShader |
+                      vk::PipelineStageFlagBits2::eTransfer,
+                  vk::AccessFlagBits2::eShaderStorageWrite |
+                      vk::AccessFlagBits2::eTransferWrite,
+                  vk::PipelineStageFlagBits2::eHost,
+                  vk::AccessFlagBits2::eHostRead);
+    commandBuffer.end();
+    MQueue.submit(vk::SubmitInfo{.commandBufferCount = 1,
+                                 .pCommandBuffers = &*commandBuffer},
+                  nullptr);
+    MQueue.waitIdle();
+    return MTimestampPeriod > 0.0f ? readTimestampQueries(queryPool, 0) : 0.0;
+  };
+
+  // Orders are swept by overriding the option the uniform buffer is
+  // written from.
+  const uint32_t order = MOptions.fmmOrder;
+  for (uint32_t count : {1u << 14, 1u << 16, 1u << 18, SMaxParticleCount}) {
+    uint32_t samples = std::min(count, SFmmSampleCount);
+    updateUniformBuffer(OutState, 0.0f, count);
+    double time = run([&](vk::raii::CommandBuffer &commandBuffer) {
+      ComputePushConstants pushConstants{.particleCount = samples};
+      commandBuffer.pushConstants<ComputePushConstants>(
+          MComputePipelineLayout, vk::ShaderStageFlagBits::eCompute, 0,
+          pushConstants);
+      commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                                 MFmmDirectPipeline);
+      commandBuffer.dispatch(
+          (samples + SComputeWorkItems - 1) / SComputeWorkItems, 1, 1);
+    });
+    // Summing every pair takes as long for each particle as the samples did
+    double allPairsTime = time * count / samples;
+    std::cout << std::format("all-pairs n={:<8} {:.3f} ms {:.2f} Mpart/s",
+                             count, allPairsTime,
+                             allPairsTime > 0.0
+                                 ? count / (allPairsTime * 1000.0)
+                                 : 0.0)
+              << std::endl;
+
+    for (uint32_t fmmOrder : {2u, 4u, 6u, 8u, 12u, SFmmMaxOrder}) {
+      MOptions.fmmOrder = fmmOrder;
+      updateUniformBuffer(OutState, 0.0f, count);
+      time = run([&](vk::raii::CommandBuffer &commandBuffer) {
+        recordFmmCommands(commandBuffer, InState, OutState, count);
+      });
+      vk::DeviceSize sampleSize = sizeof(glm::vec2) * samples;
+      run([&](vk::raii::CommandBuffer &commandBuffer) {
+        commandBuffer.copyBuffer(*MFmmFieldBuffer, *sampleBuffer,
+                                 vk::BufferCopy(0, 0, sampleSize));
+      });
+
+      // Relative RMS error of the field over the sampled particles
+      double errorSum = 0.0;
+      double referenceSum = 0.0;
+      for (uint32_t i = 0; i < samples; i++) {
+        glm::vec2 difference = sampleFields[i] - MFmmReferenceMapped[i];
+        errorSum += glm::dot(difference, difference);
+        referenceSum +=
+            glm::dot(MFmmReferenceMapped[i], MFmmReferenceMapped[i]);
+      }
+      std::cout << std::format(
+                       "fmm       n={:<8} p={:<2} {:.3f} ms {:.2f} Mpart/s "
+                       "rms error {:.2e}",
+                       count, fmmOrder, time,
+                       time > 0.0 ? count / (time * 1000.0) : 0.0,
+                       std::sqrt(errorSum / referenceSum))
+                << std::endl;
+    }
+  }
+  MOptions.fmmOrder = order;
+}
@@ -16,12 +16,53 @@ void framebufferResizeCallback(GLFWwindow *window, int width, int height) {
   auto app = reinterpret_cast<vkParticle *>(glfwGetWindowUserPointer(window));
   app->MFramebufferResized = true;
 }
+
+// Callback invoked on key press, which toggles the force modules of the fused
+// compute kernel with the number keys.
+void keyCallback(GLFWwindow *window, int key, int scancode, int action,
+                 int mods) {
+  constexpr std::array Modules{ForceModule::Field, ForceModule::Gravity,
+                               ForceModule::Drag};
+  if (action != GLFW_PRESS || key < GLFW_KEY_1 ||
+      key >= GLFW_KEY_1 + static_cast<int>(Modules.size())) {
+    return;
+  }
+  auto app = reinterpret_cast<vkParticle *>(glfwGetWindowUserPointer(window));
+  app->MForceModules ^= static_cast<uint32_t>(Modules[key - GLFW_KEY_1]);
+}
+
+// Callback invoked on mouse button press, which sets the clip space position
+// of a left click to query the particles around, or a right click to spawn
+// particles at.
+void mouseButtonCallback(GLFWwindow *window, int button, int action,
+                         int mods) {
+  if (action != GLFW_PRESS) {
+    return;
+  }
+  double x, y;
+  glfwGetCursorPos(window, &x, &y);
+  int width, height;
+  glfwGetWindowSize(window, &width, &height);
+  auto app = reinterpret_cast<vkParticle *>(glfwGetWindowUserPointer(window));
+  glm::vec2 position(2.0 * x / width - 1.0, 2.0 * y / height - 1.0);
+  if (button == GLFW_MOUSE_BUTTON_LEFT) {
+    app->MCursorClick = position;
+  } else if (button == GLFW_MOUSE_BUTTON_RIGHT) {
+    app->MCursorSpawn = position;
+  }
+}
 } // anonymous namespace
 
 void vkParticle::run() {
   initWindow();
   initVulkan();
-  mainLoop();
+  if (MOptions.benchmarkPrimitives) {
+    benchmarkPrimitives();
+  } else if (MOptions.benchmarkFmm) {
+    benchmarkFmm();
+  } else {
+    mainLoop();
+  }
   cleanup();
 }
 
@@ -35,6 +76,13 @@ void vkParticle::initWindow() {
                              nullptr);
   glfwSetWindowUserPointer(MWindow, this);
   glfwSetFramebufferSizeCallback(MWindow, framebufferResizeCallback);
+  if (MOptions.kernel == ComputeKernel::Fused) {
+    MForceModules = MOptions.forceModules;
+    glfwSetKeyCallback(MWindow, keyCallback);
+  }
+  if (MOptions.spatialQueries || MOptions.injection) {
+    glfwSetMouseButtonCallback(MWindow, mouseButtonCallback);
+  }
 }
 
 void vkParticle::initVulkan() {
@@ -51,11 +99,32 @@ void vkParticle::initVulkan() {
   createCommandPool();
   createShaderStorageBuffers();
   createUniformBuffers();
+  createMultiRateBuffers();
+  createWorkQueueBuffer();
+  createGridBuffers();
+  createNeighbourListBuffers();
+  createSpatialQueryBuffers();
+  createSpawnRingBuffer();
+  createAnalytics();
+  createPlasmaBuffers();
+  createFluidBuffers();
+  createFmmBuffers();
   createDescriptorPool();
   createComputeDescriptorSets();
+  if (MComputePresent) {
+    createSplatPipeline();
+    createSplatDescriptorSets();
+  }
+  if (MOptions.renderer == Renderer::Surface) {
+    createSurfaceRenderer();
+  }
   createGraphicsCommandBuffers();
   createComputeCommandBuffers();
   createSyncObjects();
+  createQueryPools();
+  if (usesPrimitives()) {
+    createPrimitivePipelines();
+  }
 }
 
 void vkParticle::cleanup() {
@@ -164,28 +233,53 @@ void vkParticle::setupDebugMessenger() {
 }
 
 void vkParticle::mainLoop() {
+  // Simulation runs decoupled from rendering on its own thread, with the
+  // renderer picking up whichever state was most recently completed.
+  MSimulationThread = std::jthread(
+      [this](std::stop_token stopToken) { simulationLoop(stopToken); });
+
   // Exit on escape key press or GUI window close
   while (glfwGetKey(MWindow, GLFW_KEY_ESCAPE) != GLFW_PRESS &&
-         !glfwWindowShouldClose(MWindow)) {
+         !glfwWindowShouldClose(MWindow) && !MSimulationFailed) {
     glfwPollEvents();
     drawFrame();
-    // We want to animate the particle system using the last frames time to get
-    // smooth, frame-rate independent animation
-    double currentTime = glfwGetTime();
-    MLastFrameTime = (currentTime - MLastTime) * 1000.0;
-    MLastTime = currentTime;
+    if (MOptions.spatialQueries) {
+      updateCursorQuery();
+    }
+    if (MOptions.injection) {
+      updateCursorSpawn();
+    }
   }
+
+  MSimulationThread.request_stop();
+  MSimulationThread.join();
   MDevice.waitIdle();
+  if (MSimulationError) {
+    std::rethrow_exception(MSimulationError);
+  }
 }
 
 void vkParticle::createSyncObjects() {
   MInFlightFences.clear();
 
-  // Create a timeline semaphore with counter initialized to zero.
+  // Create timeline semaphores with counters initialized to zero. The compute
+  // timeline is only signalled by the simulation thread, and the graphics
+  // timeline only by the render thread.
   vk::SemaphoreTypeCreateInfo semaphoreType{
       .semaphoreType = vk::SemaphoreType::eTimeline, .initialValue = 0};
-  MSemaphore = vk::raii::Semaphore(MDevice, {.pNext = &semaphoreType});
-  MTimelineValue = 0;
+  MComputeSemaphore = vk::raii::Semaphore(MDevice, {.pNext = &semaphoreType});
+  MComputeTimelineValue = 0;
+  MGraphicsSemaphore = vk::raii::Semaphore(MDevice, {.pNext = &semaphoreType});
+  MGraphicsTimelineValue = 0;
+
+  // All states start with the same initial data, so the renderer begins
+  // drawing one state while the simulation reads another and writes the last.
+  MSimulationStates.assign(
+      SSimulationStateCount,
+      SimulationState{.particleCount = SMinParticleCount});
+  MLatestState = 0;
+  MRenderState = 1;
+  MRenderStateValue = 0;
 
   // Fence for host synchronization for each possible frame.
   for (size_t i = 0; i < SMaxFramesInFlight; i++) {
@@ -0,0 +1,106 @@
+// Copyright (c) 2025-2026 Ewan Crawford
+
+#include "common.hpp"
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+
+namespace {
+// Particles spawned by a right click, and the speed they burst out at
+constexpr uint32_t CursorSpawnCount = 64;
+constexpr float CursorSpawnSpeed = 0.0005f;
+} // anonymous namespace
+
+bool vkParticle::injectParticles(std::span<const SpawnRecord> spawns) {
+  if (!MOptions.injection) {
+    throw std::runtime_error("particle injection requires '--inject'");
+  }
+
+  // Reserve a contiguous range of positions, as long as the slots they wrap
+  // onto have been released by the step which last injected from them.
+  const uint64_t count = spawns.size();
+  uint64_t first = MSpawnReserved.load(std::memory_order_relaxed);
+  do {
+    if (first + count - MSpawnReleased.load(std::memory_order_acquire) >
+        SSpawnRingCapacity) {
+      return false;
+    }
+  } while (!MSpawnReserved.compare_exchange_weak(first, first + count,
+                                                  std::memory_order_relaxed));
+
+  // Publish each slot once written, so the simulation thread takes every
+  // particle written before a slot still being written by another producer.
+  for (uint64_t position = first; position < first + count; position++) {
+    const uint64_t slot = position % SSpawnRingCapacity;
+    MSpawnRingMapped[slot] = spawns[position - first];
+    MSpawnSequences[slot].store(position + 1, std::memory_order_release);
+  }
+  return true;
+}
+
+void vkParticle::acquireSpawnRecords(uint32_t particleCount) {
+  // Slots are only written between being released and published, so the
+  // ring is read by the step without copying.
+  MSpawnFirst = MSpawnReleased.load(std::memory_order_relaxed);
+  MSpawnCount = 0;
+  const uint32_t maxCount = std::min(particleCount, SSpawnRingCapacity);
+  while (MSpawnCount < maxCount &&
+         MSpawnSequences[(MSpawnFirst + MSpawnCount) % SSpawnRingCapacity].load(
+             std::memory_order_acquire) == MSpawnFirst + MSpawnCount + 1) {
+    MSpawnCount++;
+  }
+
+  // Injected particles replace the active particles in turn, so that the
+  // oldest injected are replaced first.
+  MSpawnTarget = MSpawnCursor % particleCount;
+  MSpawnCursor = MSpawnTarget + MSpawnCount;
+}
+
+void vkParticle::recordInjectCommands(vk::raii::CommandBuffer &commandBuffer) {
+  if (MSpawnCount == 0) {
+    return;
+  }
+
+  // Overwrite the particles after the step has written them
+  memoryBarrier(commandBuffer, vk::PipelineStageFlagBits2::eComputeShader,
+                vk::AccessFlagBits2::eShaderStorageWrite,
+                vk::PipelineStageFlagBits2::eComputeShader,
+                vk::AccessFlagBits2::eShaderStorageRead |
+                    vk::AccessFlagBits2::eShaderStorageWrite);
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             MInjectPipeline);
+  commandBuffer.dispatch(
+      (MSpawnCount + SComputeWorkItems - 1) / SComputeWorkItems, 1, 1);
+}
+
+void vkParticle::releaseSpawnRecords() {
+  // Sequence numbers of the released slots are left in place, as the
+  // position a producer next writes to each slot is always greater.
+  MSpawnReleased.store(MSpawnFirst + MSpawnCount, std::memory_order_release);
+  MSpawnCount = 0;
+}
+
+void vkParticle::updateCursorSpawn() {
+  if (!MCursorSpawn) {
+    return;
+  }
+
+  // Burst of particles out from the cursor in a single random color
+  std::default_random_engine rndEngine(std::random_device{}());
+  std::uniform_real_distribution rndDist(0.0f, 1.0f);
+  constexpr float Pi = 3.14159265358979323846f;
+  glm::vec4 color(rndDist(rndEngine), rndDist(rndEngine), rndDist(rndEngine),
+                  1.0f);
+  std::vector<SpawnRecord> spawns(CursorSpawnCount);
+  for (uint32_t i = 0; i < CursorSpawnCount; i++) {
+    float theta = 2.0f * Pi * i / CursorSpawnCount;
+    spawns[i] = {.position = *MCursorSpawn,
+                 .velocity = glm::vec2(cosf(theta), sinf(theta)) *
+                             CursorSpawnSpeed * rndDist(rndEngine),
+                 .color = color};
+  }
+  // Retried on the next frame if the ring is full
+  if (injectParticles(spawns)) {
+    MCursorSpawn.reset();
+  }
+}
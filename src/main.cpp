@@ -3,10 +3,9 @@
 #include "common.hpp"
 #include <iostream>
 
-int main() {
-  vkParticle app;
-
+int main(int argc, char **argv) {
   try {
+    vkParticle app(parseOptions(argc, argv));
     app.run();
   } catch (const std::exception &e) {
     std::cerr << e.what() << std::endl;
@@ -0,0 +1,280 @@
+// Copyright (c) 2025-2026 Ewan Crawford
+
+#include "common.hpp"
+#include <charconv>
+#include <format>
+#include <stdexcept>
+#include <string_view>
+
+namespace {
+constexpr std::string_view Usage =
+    "usage: vkParticle "
+    "[--kernel=euler|multi-rate|multi-step|half|persistent|collide|fused|"
+    "fmm] [--fmm-order=<order>] "
+    "[--mode=ballistic|force-field|plasma|magnetised-plasma|fluid|"
+    "brownian|clusters] "
+    "[--steps=<count>] [--forces=<field,gravity,drag>] "
+    "[--distribution=disc|uniform|clustered|point] [--seed=<seed>] "
+    "[--initial-state=<file>] "
+    "[--renderer=graphics|compute|surface] [--neighbour-lists] "
+    "[--schedule=dispatch|grid-stride|queue] "
+    "[--incremental-grid=<max churn %>] [--queries] [--inject] "
+    "[--analytics=<file.csv>] [--analytics-interval=<steps>] [--stats] "
+    "[--bench-primitives] [--bench-fmm]";
+
+ComputeKernel parseKernel(std::string_view name) {
+  if (name == "euler") {
+    return ComputeKernel::Euler;
+  }
+  if (name == "multi-rate") {
+    return ComputeKernel::MultiRate;
+  }
+  if (name == "multi-step") {
+    return ComputeKernel::MultiStep;
+  }
+  if (name == "half") {
+    return ComputeKernel::Half;
+  }
+  if (name == "persistent") {
+    return ComputeKernel::Persistent;
+  }
+  if (name == "collide") {
+    return ComputeKernel::Collide;
+  }
+  if (name == "fused") {
+    return ComputeKernel::Fused;
+  }
+  if (name == "fmm") {
+    return ComputeKernel::Fmm;
+  }
+  throw std::runtime_error(
+      std::format("unknown compute kernel '{}'\n{}", name, Usage));
+}
+
+SimulationMode parseMode(std::string_view name) {
+  if (name == "ballistic") {
+    return SimulationMode::Ballistic;
+  }
+  if (name == "force-field") {
+    return SimulationMode::ForceField;
+  }
+  if (name == "plasma") {
+    return SimulationMode::Plasma;
+  }
+  if (name == "magnetised-plasma") {
+    return SimulationMode::MagnetisedPlasma;
+  }
+  if (name == "fluid") {
+    return SimulationMode::Fluid;
+  }
+  if (name == "brownian") {
+    return SimulationMode::Brownian;
+  }
+  if (name == "clusters") {
+    return SimulationMode::Clusters;
+  }
+  throw std::runtime_error(
+      std::format("unknown simulation mode '{}'\n{}", name, Usage));
+}
+
+Distribution parseDistribution(std::string_view name) {
+  if (name == "disc") {
+    return Distribution::Disc;
+  }
+  if (name == "uniform") {
+    return Distribution::Uniform;
+  }
+  if (name == "clustered") {
+    return Distribution::Clustered;
+  }
+  if (name == "point") {
+    return Distribution::Point;
+  }
+  throw std::runtime_error(
+      std::format("unknown distribution '{}'\n{}", name, Usage));
+}
+
+Schedule parseSchedule(std::string_view name) {
+  if (name == "dispatch") {
+    return Schedule::Dispatch;
+  }
+  if (name == "grid-stride") {
+    return Schedule::GridStride;
+  }
+  if (name == "queue") {
+    return Schedule::Queue;
+  }
+  throw std::runtime_error(
+      std::format("unknown schedule '{}'\n{}", name, Usage));
+}
+
+Renderer parseRenderer(std::string_view name) {
+  if (name == "graphics") {
+    return Renderer::Graphics;
+  }
+  if (name == "compute") {
+    return Renderer::Compute;
+  }
+  if (name == "surface") {
+    return Renderer::Surface;
+  }
+  throw std::runtime_error(
+      std::format("unknown renderer '{}'\n{}", name, Usage));
+}
+
+uint32_t parseForceModules(std::string_view names) {
+  // Comma separated list, which may be empty to disable all modules
+  uint32_t forceModules = 0;
+  while (!names.empty()) {
+    size_t comma = names.find(',');
+    std::string_view name = names.substr(0, comma);
+    if (name == "field") {
+      forceModules |= static_cast<uint32_t>(ForceModule::Field);
+    } else if (name == "gravity") {
+      forceModules |= static_cast<uint32_t>(ForceModule::Gravity);
+    } else if (name == "drag") {
+      forceModules |= static_cast<uint32_t>(ForceModule::Drag);
+    } else {
+      throw std::runtime_error(
+          std::format("unknown force module '{}'\n{}", name, Usage));
+    }
+    names = comma == std::string_view::npos ? std::string_view()
+                                            : names.substr(comma + 1);
+  }
+  return forceModules;
+}
+
+uint32_t parseCount(std::string_view arg, std::string_view value) {
+  uint32_t count = 0;
+  auto [end, error] =
+      std::from_chars(value.data(), value.data() + value.size(), count);
+  if (error != std::errc() || end != value.data() + value.size() ||
+      count == 0) {
+    throw std::runtime_error(
+        std::format("invalid count for '{}'\n{}", arg, Usage));
+  }
+  return count;
+}
+} // anonymous namespace
+
+Options parseOptions(int argc, char **argv) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    std::string_view arg = argv[i];
+    constexpr std::string_view KernelArg = "--kernel=";
+    constexpr std::string_view ModeArg = "--mode=";
+    constexpr std::string_view StepsArg = "--steps=";
+    constexpr std::string_view RendererArg = "--renderer=";
+    constexpr std::string_view ScheduleArg = "--schedule=";
+    constexpr std::string_view ForcesArg = "--forces=";
+    constexpr std::string_view DistributionArg = "--distribution=";
+    constexpr std::string_view IncrementalGridArg = "--incremental-grid=";
+    constexpr std::string_view FmmOrderArg = "--fmm-order=";
+    constexpr std::string_view AnalyticsArg = "--analytics=";
+    constexpr std::string_view AnalyticsIntervalArg = "--analytics-interval=";
+    constexpr std::string_view SeedArg = "--seed=";
+    constexpr std::string_view InitialStateArg = "--initial-state=";
+    if (arg.starts_with(KernelArg)) {
+      options.kernel = parseKernel(arg.substr(KernelArg.size()));
+    } else if (arg.starts_with(ModeArg)) {
+      options.mode = parseMode(arg.substr(ModeArg.size()));
+    } else if (arg.starts_with(StepsArg)) {
+      options.stepCount = parseCount(arg, arg.substr(StepsArg.size()));
+    } else if (arg.starts_with(ForcesArg)) {
+      options.forceModules = parseForceModules(arg.substr(ForcesArg.size()));
+    } else if (arg.starts_with(DistributionArg)) {
+      options.distribution =
+          parseDistribution(arg.substr(DistributionArg.size()));
+    } else if (arg.starts_with(RendererArg)) {
+      options.renderer = parseRenderer(arg.substr(RendererArg.size()));
+    } else if (arg.starts_with(ScheduleArg)) {
+      options.schedule = parseSchedule(arg.substr(ScheduleArg.size()));
+    } else if (arg.starts_with(IncrementalGridArg)) {
+      options.gridChurnThreshold =
+          parseCount(arg, arg.substr(IncrementalGridArg.size()));
+      if (options.gridChurnThreshold > 100) {
+        throw std::runtime_error(
+            std::format("invalid percentage for '{}'\n{}", arg, Usage));
+      }
+    } else if (arg.starts_with(FmmOrderArg)) {
+      options.fmmOrder = parseCount(arg, arg.substr(FmmOrderArg.size()));
+      if (options.fmmOrder > vkParticle::SFmmMaxOrder) {
+        throw std::runtime_error(std::format(
+            "order of '{}' is at most {}\n{}", arg, vkParticle::SFmmMaxOrder,
+            Usage));
+      }
+    } else if (arg.starts_with(AnalyticsArg)) {
+      options.analyticsFile = arg.substr(AnalyticsArg.size());
+    } else if (arg.starts_with(AnalyticsIntervalArg)) {
+      options.analyticsInterval =
+          parseCount(arg, arg.substr(AnalyticsIntervalArg.size()));
+    } else if (arg.starts_with(SeedArg)) {
+      options.seed = parseCount(arg, arg.substr(SeedArg.size()));
+    } else if (arg.starts_with(InitialStateArg)) {
+      options.initialStateFile = arg.substr(InitialStateArg.size());
+    } else if (arg == "--queries") {
+      options.spatialQueries = true;
+    } else if (arg == "--inject") {
+      options.injection = true;
+    } else if (arg == "--neighbour-lists") {
+      options.neighbourLists = true;
+    } else if (arg == "--stats") {
+      options.stats = true;
+    } else if (arg == "--bench-primitives") {
+      options.benchmarkPrimitives = true;
+    } else if (arg == "--bench-fmm") {
+      options.benchmarkFmm = true;
+    } else {
+      throw std::runtime_error(
+          std::format("unknown argument '{}'\n{}", arg, Usage));
+    }
+  }
+  if (options.neighbourLists && options.kernel != ComputeKernel::Collide) {
+    throw std::runtime_error(
+        std::format("'--neighbour-lists' requires '--kernel=collide'\n{}",
+                    Usage));
+  }
+  if (options.schedule != Schedule::Dispatch &&
+      options.kernel != ComputeKernel::Collide) {
+    throw std::runtime_error(
+        std::format("'--schedule' requires '--kernel=collide'\n{}", Usage));
+  }
+  if (options.gridChurnThreshold > 0 &&
+      options.kernel != ComputeKernel::Collide) {
+    throw std::runtime_error(
+        std::format("'--incremental-grid' requires '--kernel=collide'\n{}",
+                    Usage));
+  }
+  if (options.benchmarkFmm && options.kernel != ComputeKernel::Fmm) {
+    throw std::runtime_error(
+        std::format("'--bench-fmm' requires '--kernel=fmm'\n{}", Usage));
+  }
+  if ((options.mode == SimulationMode::Plasma ||
+       options.mode == SimulationMode::MagnetisedPlasma) &&
+      options.kernel != ComputeKernel::Euler) {
+    throw std::runtime_error(std::format(
+        "plasma modes require '--kernel=euler'\n{}", Usage));
+  }
+  if (options.mode == SimulationMode::Fluid &&
+      options.kernel != ComputeKernel::Euler) {
+    throw std::runtime_error(std::format(
+        "'--mode=fluid' requires '--kernel=euler'\n{}", Usage));
+  }
+  if (options.mode == SimulationMode::Brownian &&
+      options.kernel != ComputeKernel::Euler) {
+    throw std::runtime_error(std::format(
+        "'--mode=brownian' requires '--kernel=euler'\n{}", Usage));
+  }
+  if (options.mode == SimulationMode::Clusters &&
+      options.kernel != ComputeKernel::Euler) {
+    throw std::runtime_error(std::format(
+        "'--mode=clusters' requires '--kernel=euler'\n{}", Usage));
+  }
+  // Clusters are arranged along with generating the initial particles
+  if (options.mode == SimulationMode::Clusters &&
+      !options.initialStateFile.empty()) {
+    throw std::runtime_error(std::format(
+        "'--mode=clusters' can't be used with '--initial-state'\n{}", Usage));
+  }
+  return options;
+}
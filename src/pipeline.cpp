@@ -1,6 +1,7 @@
 // Copyright (c) 2025-2026 Ewan Crawford
 
 #include "common.hpp"
+#include <utility>
 
 void vkParticle::createGraphicsPipeline() {
   // Setup vertex & fragment shaders
@@ -19,10 +20,10 @@ void vkParticle::createGraphicsPipeline() {
                                                       fragShaderStageInfo};
 
   // Defines the stride between vertex shader input elements
-  auto bindingDescription = Particle::getBindingDescription();
+  auto bindingDescription = RenderVertex::getBindingDescription();
   // Defines how the individual elements in the vertex shader input struct
   // are laid out.
-  auto attributeDescriptions = Particle::getAttributeDescriptions();
+  auto attributeDescriptions = RenderVertex::getAttributeDescriptions();
   vk::PipelineVertexInputStateCreateInfo vertexInputInfo{
       .vertexBindingDescriptionCount = 1,
       .pVertexBindingDescriptions = &bindingDescription,
@@ -121,33 +122,232 @@ void vkParticle::createGraphicsPipeline() {
   MGraphicsPipeline = vk::raii::Pipeline(MDevice, nullptr, pipelineInfo);
 }
 
+void vkParticle::createSplatPipeline() {
+  // The splat shaders use the descriptor bindings of set 1:
+  // 0. `StructuredBuffer<ParticleSSBO>` state being drawn
+  // 1. `RWTexture2D<float4>` swapchain image
+  std::array layoutBindings{
+      vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eStorageBuffer, 1,
+                                     vk::ShaderStageFlagBits::eCompute,
+                                     nullptr),
+      vk::DescriptorSetLayoutBinding(1, vk::DescriptorType::eStorageImage, 1,
+                                     vk::ShaderStageFlagBits::eCompute,
+                                     nullptr)};
+  vk::DescriptorSetLayoutCreateInfo layoutInfo{
+      .bindingCount = static_cast<uint32_t>(layoutBindings.size()),
+      .pBindings = layoutBindings.data()};
+  MSplatDescriptorSetLayout =
+      vk::raii::DescriptorSetLayout(MDevice, layoutInfo);
+
+  // Set 0 is never used by the splat shaders, but keeps the simulation
+  // bindings at the same set index as they are in the shader source.
+  std::array setLayouts{*MComputeDescriptorSetLayout,
+                        *MSplatDescriptorSetLayout};
+  vk::PushConstantRange pushConstantRange{
+      .stageFlags = vk::ShaderStageFlagBits::eCompute,
+      .offset = 0,
+      .size = sizeof(ComputePushConstants)};
+  vk::PipelineLayoutCreateInfo pipelineLayoutInfo{
+      .setLayoutCount = static_cast<uint32_t>(setLayouts.size()),
+      .pSetLayouts = setLayouts.data(),
+      .pushConstantRangeCount = 1,
+      .pPushConstantRanges = &pushConstantRange};
+  MSplatPipelineLayout = vk::raii::PipelineLayout(MDevice, pipelineLayoutInfo);
+
+  // Splat shaders are compiled to a module of their own, as writing storage
+  // images without a format is only valid on devices with the feature.
+  vk::raii::ShaderModule shaderModule =
+      createShaderModule(readFile("slang_splat.spv"), MDevice);
+  MSplatClearPipeline = createComputeKernel(shaderModule, "compSplatClear",
+                                            &MSplatPipelineLayout);
+  MSplatPipeline =
+      createComputeKernel(shaderModule, "compSplat", &MSplatPipelineLayout);
+}
+
 void vkParticle::createComputePipeline() {
   // Load compute shader from file
   vk::raii::ShaderModule shaderModule =
       createShaderModule(readFile("slang.spv"), MDevice);
 
+  // All compute kernels share a pipeline layout, so that a descriptor set
+  // stays bound when switching between them. Kernels dispatched more than
+  // once a step take their per-dispatch arguments as push constants.
+  vk::PushConstantRange pushConstantRange{
+      .stageFlags = vk::ShaderStageFlagBits::eCompute,
+      .offset = 0,
+      .size = sizeof(ComputePushConstants)};
+  vk::PipelineLayoutCreateInfo pipelineLayoutInfo{
+      .setLayoutCount = 1,
+      .pSetLayouts = &*MComputeDescriptorSetLayout,
+      .pushConstantRangeCount = 1,
+      .pPushConstantRanges = &pushConstantRange};
+  MComputePipelineLayout =
+      vk::raii::PipelineLayout(MDevice, pipelineLayoutInfo);
+
+  // Two level grid built by the collide kernel, and to answer spatial
+  // queries and measure analytics from.
+  if (usesGrid()) {
+    MGridCountPipeline = createComputeKernel(shaderModule, "compGridCount");
+    MGridScatterPipeline = createComputeKernel(shaderModule, "compGridScatter");
+  }
+  if (MOptions.spatialQueries) {
+    MSpatialQueryPipeline =
+        createComputeKernel(shaderModule, "compSpatialQuery");
+  }
+  if (MOptions.injection) {
+    MInjectPipeline = createComputeKernel(shaderModule, "compInject");
+  }
+  if (!MOptions.analyticsFile.empty()) {
+    MSpeedHistogramPipeline =
+        createComputeKernel(shaderModule, "compSpeedHistogram");
+    MPairHistogramPipeline =
+        createComputeKernel(shaderModule, "compPairHistogram");
+  }
+  if (usesPlasma()) {
+    MPlasmaDepositPipeline =
+        createComputeKernel(shaderModule, "compPlasmaDeposit");
+    MPlasmaSolvePipeline = createComputeKernel(shaderModule, "compPlasmaSolve");
+    MPlasmaFieldPipeline = createComputeKernel(shaderModule, "compPlasmaField");
+    MPlasmaPushPipeline = createComputeKernel(shaderModule, "compPlasmaPush");
+  }
+  if (MOptions.mode == SimulationMode::Fluid) {
+    MFluidTransferPipeline =
+        createComputeKernel(shaderModule, "compFluidTransfer");
+    MFluidNormalisePipeline =
+        createComputeKernel(shaderModule, "compFluidNormalise");
+    MFluidDivergencePipeline =
+        createComputeKernel(shaderModule, "compFluidDivergence");
+    MFluidJacobiPipeline = createComputeKernel(shaderModule, "compFluidJacobi");
+    MFluidProjectPipeline =
+        createComputeKernel(shaderModule, "compFluidProject");
+    MFluidGatherPipeline = createComputeKernel(shaderModule, "compFluidGather");
+  }
+  if (MOptions.mode == SimulationMode::Clusters) {
+    MShapeMatchPipeline = createComputeKernel(shaderModule, "compShapeMatch");
+  }
+  if (usesRenderStream()) {
+    MRenderStreamPipeline =
+        createComputeKernel(shaderModule, "compRenderStream");
+  }
+
+  // Kernels which advance the particles with a single dispatch per step
+  // share `MComputePipeline`.
+  switch (MOptions.kernel) {
+  case ComputeKernel::Euler:
+    MComputePipeline = createComputeKernel(shaderModule, "compMain");
+    break;
+  case ComputeKernel::MultiRate:
+    MMultiRateBinPipeline =
+        createComputeKernel(shaderModule, "compMultiRateBin");
+    MMultiRateArgsPipeline =
+        createComputeKernel(shaderModule, "compMultiRateArgs");
+    MMultiRateStepPipeline =
+        createComputeKernel(shaderModule, "compMultiRateStep");
+    break;
+  case ComputeKernel::MultiStep:
+    MComputePipeline = createComputeKernel(shaderModule, "compMultiStep");
+    break;
+  case ComputeKernel::Half: {
+    // Half precision kernel is compiled to a module of its own, as the fp16
+    // capability it declares is only valid on devices with the feature.
+    vk::raii::ShaderModule halfShaderModule =
+        createShaderModule(readFile("slang_half.spv"), MDevice);
+    MComputePipeline = createComputeKernel(halfShaderModule, "compMainHalf");
+    if (MOptions.stats) {
+      MPrecisionErrorPipeline =
+          createComputeKernel(shaderModule, "compPrecisionError");
+    }
+    break;
+  }
+  case ComputeKernel::Persistent:
+    MComputePipeline = createComputeKernel(shaderModule, "compPersistent");
+    break;
+  case ComputeKernel::Collide: {
+    if (MOptions.gridChurnThreshold > 0) {
+      MGridComparePipeline =
+          createComputeKernel(shaderModule, "compGridCompare");
+      MGridStartsPipeline = createComputeKernel(shaderModule, "compGridStarts");
+      MGridMergePipeline = createComputeKernel(shaderModule, "compGridMerge");
+    }
+    if (MOptions.neighbourLists) {
+      MNeighbourBuildPipeline =
+          createComputeKernel(shaderModule, "compNeighbourBuild");
+    }
+    // Each schedule has an entry point of its own
+    std::string entryPoint =
+        MOptions.neighbourLists ? "compCollideLists" : "compCollide";
+    if (MOptions.schedule == Schedule::GridStride) {
+      entryPoint += "Stride";
+    } else if (MOptions.schedule == Schedule::Queue) {
+      entryPoint += "Queue";
+    }
+    MComputePipeline = createComputeKernel(shaderModule, entryPoint.c_str());
+    break;
+  }
+  case ComputeKernel::Fmm:
+    MFmmMultipolePipeline =
+        createComputeKernel(shaderModule, "compFmmMultipole");
+    MFmmUpwardPipeline = createComputeKernel(shaderModule, "compFmmUpward");
+    MFmmInteractPipeline = createComputeKernel(shaderModule, "compFmmInteract");
+    MFmmDownwardPipeline = createComputeKernel(shaderModule, "compFmmDownward");
+    MFmmNearPipeline = createComputeKernel(shaderModule, "compFmmNear");
+    if (MOptions.benchmarkFmm) {
+      MFmmDirectPipeline = createComputeKernel(shaderModule, "compFmmDirect");
+    }
+    break;
+  case ComputeKernel::Fused:
+    // Other combinations are specialized on demand as modules are toggled
+    MFusedShaderModule = std::move(shaderModule);
+    getFusedPipeline(MOptions.forceModules);
+    break;
+  }
+}
+
+vk::raii::Pipeline &vkParticle::getFusedPipeline(uint32_t forceModules) {
+  auto pipelineIt = MFusedPipelines.find(forceModules);
+  if (pipelineIt == MFusedPipelines.end()) {
+    pipelineIt =
+        MFusedPipelines
+            .emplace(forceModules,
+                     createComputeKernel(MFusedShaderModule, "compFused",
+                                         nullptr, forceModules))
+            .first;
+  }
+  return pipelineIt->second;
+}
+
+vk::raii::Pipeline
+vkParticle::createComputeKernel(vk::raii::ShaderModule &shaderModule,
+                                const char *entryPoint,
+                                const vk::raii::PipelineLayout *layout,
+                                uint32_t forceModules) {
   // Specialization constant for number of threads/invocations/work-items
   // in compute shader work-group.
   // Default constant ID in Slang is 1 if nothing is specified.
-  vk::SpecializationMapEntry specMapEntry{
-      .constantID = 1, .offset = 0, .size = sizeof(uint32_t)};
+  // Constant ID 2 is the mask of force modules `compFused` is specialized
+  // for, which entry points without the constant ignore.
+  std::array specData{SComputeWorkItems, forceModules};
+  std::array specMapEntries{
+      vk::SpecializationMapEntry{
+          .constantID = 1, .offset = 0, .size = sizeof(uint32_t)},
+      vk::SpecializationMapEntry{.constantID = 2,
+                                 .offset = sizeof(uint32_t),
+                                 .size = sizeof(uint32_t)}};
 
-  vk::SpecializationInfo specInfo{.mapEntryCount = 1,
-                                  .pMapEntries = &specMapEntry,
-                                  .dataSize = sizeof(SComputeWorkItems),
-                                  .pData = &SComputeWorkItems};
+  vk::SpecializationInfo specInfo{
+      .mapEntryCount = static_cast<uint32_t>(specMapEntries.size()),
+      .pMapEntries = specMapEntries.data(),
+      .dataSize = sizeof(specData),
+      .pData = specData.data()};
   vk::PipelineShaderStageCreateInfo computeShaderStageInfo{
       .stage = vk::ShaderStageFlagBits::eCompute,
       .module = shaderModule,
-      .pName = "compMain",
+      .pName = entryPoint,
       .pSpecializationInfo = &specInfo};
 
-  vk::PipelineLayoutCreateInfo pipelineLayoutInfo{
-      .setLayoutCount = 1, .pSetLayouts = &*MComputeDescriptorSetLayout};
-  MComputePipelineLayout =
-      vk::raii::PipelineLayout(MDevice, pipelineLayoutInfo);
   // Create compute pipeline with a single stage for the compute shader
-  vk::ComputePipelineCreateInfo pipelineInfo{.stage = computeShaderStageInfo,
-                                             .layout = *MComputePipelineLayout};
-  MComputePipeline = vk::raii::Pipeline(MDevice, nullptr, pipelineInfo);
+  vk::ComputePipelineCreateInfo pipelineInfo{
+      .stage = computeShaderStageInfo,
+      .layout = layout ? **layout : *MComputePipelineLayout};
+  return vk::raii::Pipeline(MDevice, nullptr, pipelineInfo);
 }
@@ -0,0 +1,70 @@
+// Copyright (c) 2025-2026 Ewan Crawford
+
+#include "common.hpp"
+
+void vkParticle::recordPlasmaCommands(vk::raii::CommandBuffer &commandBuffer,
+                                      uint32_t outState,
+                                      uint32_t particleCount) {
+  uint32_t stage = 0;
+  writeStageTimestamp(commandBuffer, outState, stage);
+  auto endStage = [&] {
+    writeStageTimestamp(commandBuffer, outState, ++stage);
+  };
+  auto computeBarrier = [&] {
+    memoryBarrier(commandBuffer, vk::PipelineStageFlagBits2::eComputeShader,
+                  vk::AccessFlagBits2::eShaderStorageWrite,
+                  vk::PipelineStageFlagBits2::eComputeShader,
+                  vk::AccessFlagBits2::eShaderStorageRead |
+                      vk::AccessFlagBits2::eShaderStorageWrite);
+  };
+  uint32_t particleGroups =
+      (particleCount + SComputeWorkItems - 1) / SComputeWorkItems;
+  uint32_t nodeGroups =
+      (SPlasmaNodeCount + SComputeWorkItems - 1) / SComputeWorkItems;
+
+  // Charge is accumulated with atomics, so start from zero. The potential is
+  // only cleared before the first solve, later solves start from the last.
+  commandBuffer.fillBuffer(MPlasmaChargeBuffer, 0, vk::WholeSize, 0);
+  if (!MPlasmaPotentialCleared) {
+    commandBuffer.fillBuffer(MPlasmaPotentialBuffer, 0, vk::WholeSize, 0);
+    MPlasmaPotentialCleared = true;
+  }
+  memoryBarrier(commandBuffer, vk::PipelineStageFlagBits2::eTransfer,
+                vk::AccessFlagBits2::eTransferWrite,
+                vk::PipelineStageFlagBits2::eComputeShader,
+                vk::AccessFlagBits2::eShaderStorageRead |
+                    vk::AccessFlagBits2::eShaderStorageWrite);
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             MPlasmaDepositPipeline);
+  commandBuffer.dispatch(particleGroups, 1, 1);
+  computeBarrier();
+  endStage();
+
+  // Each red-black sweep updates half the nodes from the other half, so
+  // successive over-relaxation needs no second copy of the potential.
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             MPlasmaSolvePipeline);
+  for (uint32_t iteration = 0; iteration < SPlasmaSolveSweeps; iteration++) {
+    for (uint32_t sweep = 0; sweep < 2; sweep++) {
+      ComputePushConstants pushConstants{.sweep = sweep};
+      commandBuffer.pushConstants<ComputePushConstants>(
+          MComputePipelineLayout, vk::ShaderStageFlagBits::eCompute, 0,
+          pushConstants);
+      commandBuffer.dispatch(nodeGroups, 1, 1);
+      computeBarrier();
+    }
+  }
+  endStage();
+
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             MPlasmaFieldPipeline);
+  commandBuffer.dispatch(nodeGroups, 1, 1);
+  computeBarrier();
+  endStage();
+
+  // Gathers the field and pushes the particles into the output state
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             MPlasmaPushPipeline);
+  commandBuffer.dispatch(particleGroups, 1, 1);
+  endStage();
+}
@@ -0,0 +1,391 @@
+// Copyright (c) 2025-2026 Ewan Crawford
+
+#include "common.hpp"
+#include <algorithm>
+#include <cstring>
+#include <format>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <span>
+#include <stdexcept>
+
+namespace {
+// Elements handled by each work-group of a primitive, must match
+// `PartitionSize` in shader.
+constexpr uint32_t PartitionSize = 1024;
+// Must match the scratch layout in shader
+constexpr uint32_t RadixBins = 256;
+constexpr uint32_t RadixHistogramBase = 4;
+constexpr uint32_t RadixLookbackBase = RadixHistogramBase + 4 * RadixBins;
+
+uint32_t partitionCount(uint32_t count) {
+  return (count + PartitionSize - 1) / PartitionSize;
+}
+
+// Scratch is written by the host with fills, and by every primitive pass
+// with atomics, so each pass waits on all earlier writes.
+void primitiveBarrier(vk::raii::CommandBuffer &commandBuffer) {
+  memoryBarrier(commandBuffer,
+                vk::PipelineStageFlagBits2::eTransfer |
+                    vk::PipelineStageFlagBits2::eComputeShader,
+                vk::AccessFlagBits2::eTransferWrite |
+                    vk::AccessFlagBits2::eShaderStorageWrite,
+                vk::PipelineStageFlagBits2::eTransfer |
+                    vk::PipelineStageFlagBits2::eComputeShader,
+                vk::AccessFlagBits2::eTransferWrite |
+                    vk::AccessFlagBits2::eShaderStorageRead |
+                    vk::AccessFlagBits2::eShaderStorageWrite);
+}
+} // anonymous namespace
+
+vk::DeviceSize vkParticle::primitiveScratchSize(uint32_t count) {
+  // Radix sort needs the most, a look-back descriptor per digit per
+  // partition after the counters and histograms.
+  return sizeof(uint32_t) *
+         (RadixLookbackBase + partitionCount(count) * RadixBins);
+}
+
+void vkParticle::createPrimitivePipelines() {
+  // Primitives reduce and scan within subgroups
+  auto properties = MPhysicalDevice.getProperties2<
+      vk::PhysicalDeviceProperties2, vk::PhysicalDeviceSubgroupProperties>();
+  const auto &subgroupProperties =
+      properties.get<vk::PhysicalDeviceSubgroupProperties>();
+  if (!(subgroupProperties.supportedStages &
+        vk::ShaderStageFlagBits::eCompute) ||
+      !(subgroupProperties.supportedOperations &
+        vk::SubgroupFeatureFlagBits::eArithmetic)) {
+    throw std::runtime_error(
+        "parallel primitives require subgroup arithmetic in compute shaders!");
+  }
+
+  // The primitives use the descriptor bindings:
+  // 0. `RWStructuredBuffer<uint>` input
+  // 1. `RWStructuredBuffer<uint>` output
+  // 2. `RWStructuredBuffer<uint>` auxiliary input
+  // 3. `RWStructuredBuffer<uint>` auxiliary output
+  // 4. `RWStructuredBuffer<uint>` scratch
+  // Pushed when recording, so that any buffers can be operated on without
+  // allocating a descriptor set for each.
+  std::vector<vk::DescriptorSetLayoutBinding> layoutBindings;
+  for (uint32_t binding = 0; binding < 5; binding++) {
+    layoutBindings.emplace_back(binding, vk::DescriptorType::eStorageBuffer, 1,
+                                vk::ShaderStageFlagBits::eCompute, nullptr);
+  }
+  vk::DescriptorSetLayoutCreateInfo layoutInfo{
+      .flags = vk::DescriptorSetLayoutCreateFlagBits::ePushDescriptorKHR,
+      .bindingCount = static_cast<uint32_t>(layoutBindings.size()),
+      .pBindings = layoutBindings.data()};
+  MPrimitiveDescriptorSetLayout =
+      vk::raii::DescriptorSetLayout(MDevice, layoutInfo);
+
+  vk::PushConstantRange pushConstantRange{
+      .stageFlags = vk::ShaderStageFlagBits::eCompute,
+      .offset = 0,
+      .size = sizeof(PrimitivePushConstants)};
+  vk::PipelineLayoutCreateInfo pipelineLayoutInfo{
+      .setLayoutCount = 1,
+      .pSetLayouts = &*MPrimitiveDescriptorSetLayout,
+      .pushConstantRangeCount = 1,
+      .pPushConstantRanges = &pushConstantRange};
+  MPrimitivePipelineLayout =
+      vk::raii::PipelineLayout(MDevice, pipelineLayoutInfo);
+
+  vk::raii::ShaderModule shaderModule =
+      createShaderModule(readFile("primitives.spv"), MDevice);
+  MReducePipeline = createComputeKernel(shaderModule, "primReduce",
+                                        &MPrimitivePipelineLayout);
+  MExclusiveScanPipeline = createComputeKernel(
+      shaderModule, "primExclusiveScan", &MPrimitivePipelineLayout);
+  MCompactPipeline = createComputeKernel(shaderModule, "primCompact",
+                                         &MPrimitivePipelineLayout);
+  MRadixHistogramPipeline = createComputeKernel(
+      shaderModule, "primRadixHistogram", &MPrimitivePipelineLayout);
+  MRadixHistogramScanPipeline = createComputeKernel(
+      shaderModule, "primRadixHistogramScan", &MPrimitivePipelineLayout);
+  MRadixScatterPipeline = createComputeKernel(
+      shaderModule, "primRadixScatter", &MPrimitivePipelineLayout);
+}
+
+void vkParticle::pushPrimitiveDescriptors(
+    vk::raii::CommandBuffer &commandBuffer,
+    const std::array<vk::Buffer, 5> &buffers) {
+  // Bindings a primitive doesn't use are left unwritten
+  std::array<vk::DescriptorBufferInfo, 5> bufferInfos;
+  std::vector<vk::WriteDescriptorSet> descriptorWrites;
+  for (uint32_t binding = 0; binding < buffers.size(); binding++) {
+    if (!buffers[binding]) {
+      continue;
+    }
+    bufferInfos[binding] =
+        vk::DescriptorBufferInfo(buffers[binding], 0, vk::WholeSize);
+    descriptorWrites.push_back(
+        vk::WriteDescriptorSet{.dstBinding = binding,
+                               .dstArrayElement = 0,
+                               .descriptorCount = 1,
+                               .descriptorType =
+                                   vk::DescriptorType::eStorageBuffer,
+                               .pBufferInfo = &bufferInfos[binding]});
+  }
+  commandBuffer.pushDescriptorSetKHR(vk::PipelineBindPoint::eCompute,
+                                     *MPrimitivePipelineLayout, 0,
+                                     descriptorWrites);
+}
+
+void vkParticle::recordReduce(vk::raii::CommandBuffer &commandBuffer,
+                              vk::Buffer input, vk::Buffer output,
+                              uint32_t count, PrimitiveOp op) {
+  // Work-groups combine into the result with atomics
+  commandBuffer.fillBuffer(output, 0, sizeof(uint32_t), 0);
+  primitiveBarrier(commandBuffer);
+
+  pushPrimitiveDescriptors(commandBuffer, {input, output});
+  PrimitivePushConstants pushConstants{.count = count,
+                                       .op = static_cast<uint32_t>(op)};
+  commandBuffer.pushConstants<PrimitivePushConstants>(
+      MPrimitivePipelineLayout, vk::ShaderStageFlagBits::eCompute, 0,
+      pushConstants);
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, MReducePipeline);
+  commandBuffer.dispatch(partitionCount(count), 1, 1);
+}
+
+void vkParticle::recordExclusiveScan(vk::raii::CommandBuffer &commandBuffer,
+                                     vk::Buffer input, vk::Buffer output,
+                                     vk::Buffer scratch, uint32_t count) {
+  // Partition counter and look-back descriptors start out zero
+  commandBuffer.fillBuffer(scratch, 0, vk::WholeSize, 0);
+  primitiveBarrier(commandBuffer);
+
+  pushPrimitiveDescriptors(commandBuffer,
+                           {input, output, nullptr, nullptr, scratch});
+  PrimitivePushConstants pushConstants{.count = count};
+  commandBuffer.pushConstants<PrimitivePushConstants>(
+      MPrimitivePipelineLayout, vk::ShaderStageFlagBits::eCompute, 0,
+      pushConstants);
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             MExclusiveScanPipeline);
+  commandBuffer.dispatch(partitionCount(count), 1, 1);
+}
+
+void vkParticle::recordCompact(vk::raii::CommandBuffer &commandBuffer,
+                               vk::Buffer input, vk::Buffer flags,
+                               vk::Buffer output, vk::Buffer outputCount,
+                               vk::Buffer scratch, uint32_t count) {
+  // Count is only written by the last partition, so is zero if there are
+  // no elements at all.
+  commandBuffer.fillBuffer(scratch, 0, vk::WholeSize, 0);
+  commandBuffer.fillBuffer(outputCount, 0, sizeof(uint32_t), 0);
+  primitiveBarrier(commandBuffer);
+
+  pushPrimitiveDescriptors(commandBuffer,
+                           {input, output, flags, outputCount, scratch});
+  PrimitivePushConstants pushConstants{.count = count};
+  commandBuffer.pushConstants<PrimitivePushConstants>(
+      MPrimitivePipelineLayout, vk::ShaderStageFlagBits::eCompute, 0,
+      pushConstants);
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             MCompactPipeline);
+  commandBuffer.dispatch(partitionCount(count), 1, 1);
+}
+
+void vkParticle::recordRadixSort(vk::raii::CommandBuffer &commandBuffer,
+                                 vk::Buffer keys, vk::Buffer values,
+                                 vk::Buffer tempKeys, vk::Buffer tempValues,
+                                 vk::Buffer scratch, uint32_t count,
+                                 uint32_t keyBits) {
+  // 8 bits are sorted per pass, with an even number of passes so that the
+  // result ends up back in `keys` and `values` after ping-ponging.
+  uint32_t passCount = (keyBits + 7) / 8;
+  passCount += passCount % 2;
+  PrimitivePushConstants pushConstants{.count = count,
+                                       .radixPassCount = passCount};
+
+  commandBuffer.fillBuffer(scratch, 0, vk::WholeSize, 0);
+  primitiveBarrier(commandBuffer);
+
+  // Digit histograms of every pass are counted up front in a single read
+  pushPrimitiveDescriptors(commandBuffer,
+                           {keys, nullptr, nullptr, nullptr, scratch});
+  commandBuffer.pushConstants<PrimitivePushConstants>(
+      MPrimitivePipelineLayout, vk::ShaderStageFlagBits::eCompute, 0,
+      pushConstants);
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             MRadixHistogramPipeline);
+  commandBuffer.dispatch(partitionCount(count), 1, 1);
+  primitiveBarrier(commandBuffer);
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             MRadixHistogramScanPipeline);
+  commandBuffer.dispatch(passCount, 1, 1);
+  primitiveBarrier(commandBuffer);
+
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             MRadixScatterPipeline);
+  for (uint32_t pass = 0; pass < passCount; pass++) {
+    // Look-back descriptors are shared between passes, so are reset
+    if (pass > 0) {
+      commandBuffer.fillBuffer(scratch,
+                               sizeof(uint32_t) * RadixLookbackBase,
+                               vk::WholeSize, 0);
+      primitiveBarrier(commandBuffer);
+    }
+    bool even = pass % 2 == 0;
+    pushPrimitiveDescriptors(commandBuffer,
+                             {even ? keys : tempKeys, even ? tempKeys : keys,
+                              even ? values : tempValues,
+                              even ? tempValues : values, scratch});
+    pushConstants.radixPass = pass;
+    commandBuffer.pushConstants<PrimitivePushConstants>(
+        MPrimitivePipelineLayout, vk::ShaderStageFlagBits::eCompute, 0,
+        pushConstants);
+    commandBuffer.dispatch(partitionCount(count), 1, 1);
+    primitiveBarrier(commandBuffer);
+  }
+}
+
+void vkParticle::benchmarkPrimitives() {
+  // Printed so that a failure can be reproduced with `--seed`
+  std::default_random_engine rndEngine(MSeed);
+  std::uniform_int_distribution<uint32_t> rndDist;
+  std::cout << std::format("seed {}", MSeed) << std::endl;
+  uint32_t failures = 0;
+
+  // Timestamps bracket each primitive
+  vk::QueryPoolCreateInfo queryInfo{.queryType = vk::QueryType::eTimestamp,
+                                    .queryCount = 2};
+  vk::raii::QueryPool queryPool(MDevice, queryInfo);
+
+  for (uint32_t count : {1u << 10, 1u << 14, 1u << 18, 1u << 20}) {
+    // Host visible so that inputs and results can be accessed directly
+    vk::DeviceSize size = sizeof(uint32_t) * count;
+    constexpr size_t BufferCount = 6;
+    std::vector<vk::raii::Buffer> buffers;
+    std::vector<vk::raii::DeviceMemory> buffersMemory;
+    std::vector<uint32_t *> buffersMapped;
+    for (size_t i = 0; i < BufferCount; i++) {
+      vk::DeviceSize bufferSize =
+          i == BufferCount - 1 ? primitiveScratchSize(count) : size;
+      vk::raii::Buffer buffer({});
+      vk::raii::DeviceMemory bufferMemory({});
+      createBuffer(MDevice, MPhysicalDevice, bufferSize,
+                   vk::BufferUsageFlagBits::eStorageBuffer |
+                       vk::BufferUsageFlagBits::eTransferDst,
+                   vk::MemoryPropertyFlagBits::eHostVisible |
+                       vk::MemoryPropertyFlagBits::eHostCoherent,
+                   buffer, bufferMemory);
+      buffersMapped.push_back(
+          static_cast<uint32_t *>(bufferMemory.mapMemory(0, bufferSize)));
+      buffers.emplace_back(std::move(buffer));
+      buffersMemory.emplace_back(std::move(bufferMemory));
+    }
+    vk::Buffer in = buffers[0], out = buffers[1], inAux = buffers[2],
+               outAux = buffers[3], temp = buffers[4], scratch = buffers[5];
+    std::span<uint32_t> inData(buffersMapped[0], count);
+    std::span<uint32_t> outData(buffersMapped[1], count);
+    std::span<uint32_t> inAuxData(buffersMapped[2], count);
+    std::span<uint32_t> outAuxData(buffersMapped[3], count);
+
+    // Records a primitive into a single-submit command-buffer, waiting for
+    // it to complete and returning its GPU time in milliseconds.
+    auto run = [&](auto record) {
+      vk::CommandBufferAllocateInfo allocInfo{
+          .commandPool = MCommandPool,
+          .level = vk::CommandBufferLevel::ePrimary,
+          .commandBufferCount = 1};
+      vk::raii::CommandBuffer commandBuffer =
+          std::move(MDevice.allocateCommandBuffers(allocInfo).front());
+      commandBuffer.begin(vk::CommandBufferBeginInfo{
+          .flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+      if (MTimestampPeriod > 0.0f) {
+        commandBuffer.resetQueryPool(queryPool, 0, 2);
+        commandBuffer.writeTimestamp2(vk::PipelineStageFlagBits2::eTopOfPipe,
+                                      queryPool, 0);
+      }
+      record(commandBuffer);
+      if (MTimestampPeriod > 0.0f) {
+        commandBuffer.writeTimestamp2(
+            vk::PipelineStageFlagBits2::eComputeShader, queryPool, 1);
+      }
+      // Make results visible to the host
+      memoryBarrier(commandBuffer, vk::PipelineStageFlagBits2::eComputeShader,
+                    vk::AccessFlagBits2::eShaderStorageWrite,
+                    vk::PipelineStageFlagBits2::eHost,
+                    vk::AccessFlagBits2::eHostRead);
+      commandBuffer.end();
+      MQueue.submit(vk::SubmitInfo{.commandBufferCount = 1,
+                                   .pCommandBuffers = &*commandBuffer},
+                    nullptr);
+      MQueue.waitIdle();
+      return MTimestampPeriod > 0.0f ? readTimestampQueries(queryPool, 0)
+                                     : 0.0;
+    };
+    auto report = [&](const char *name, bool correct, double time) {
+      failures += correct ? 0 : 1;
+      std::cout << std::format("{:<8} n={:<8} {} {:.2f} Melem/s", name, count,
+                               correct ? "ok  " : "FAIL",
+                               time > 0.0 ? count / (time * 1000.0) : 0.0)
+                << std::endl;
+    };
+
+    // Small values so that sums stay within the 30 bits the scan supports
+    for (uint32_t &value : inData) {
+      value = rndDist(rndEngine) & 0xFF;
+    }
+    double time = run([&](vk::raii::CommandBuffer &commandBuffer) {
+      recordReduce(commandBuffer, in, out, count, PrimitiveOp::Sum);
+    });
+    report("reduce", outData[0] == std::reduce(inData.begin(), inData.end()),
+           time);
+
+    time = run([&](vk::raii::CommandBuffer &commandBuffer) {
+      recordExclusiveScan(commandBuffer, in, out, scratch, count);
+    });
+    std::vector<uint32_t> expected(count);
+    std::exclusive_scan(inData.begin(), inData.end(), expected.begin(), 0u);
+    report("scan", std::ranges::equal(outData, expected), time);
+
+    for (uint32_t &flag : inAuxData) {
+      flag = rndDist(rndEngine) & 1;
+    }
+    time = run([&](vk::raii::CommandBuffer &commandBuffer) {
+      recordCompact(commandBuffer, in, inAux, out, outAux, scratch, count);
+    });
+    expected.clear();
+    for (uint32_t i = 0; i < count; i++) {
+      if (inAuxData[i]) {
+        expected.push_back(inData[i]);
+      }
+    }
+    report("compact",
+           outAuxData[0] == expected.size() &&
+               std::ranges::equal(outData.first(expected.size()), expected),
+           time);
+
+    // Full width keys, with the original index as value to check stability
+    for (uint32_t i = 0; i < count; i++) {
+      inData[i] = rndDist(rndEngine);
+      inAuxData[i] = i;
+    }
+    std::vector<std::pair<uint32_t, uint32_t>> expectedPairs;
+    for (uint32_t i = 0; i < count; i++) {
+      expectedPairs.emplace_back(inData[i], inAuxData[i]);
+    }
+    std::ranges::stable_sort(expectedPairs, {},
+                             &std::pair<uint32_t, uint32_t>::first);
+    time = run([&](vk::raii::CommandBuffer &commandBuffer) {
+      recordRadixSort(commandBuffer, in, inAux, temp, out, scratch, count);
+    });
+    bool sorted = true;
+    for (uint32_t i = 0; i < count; i++) {
+      sorted &= inData[i] == expectedPairs[i].first &&
+                inAuxData[i] == expectedPairs[i].second;
+    }
+    report("sort", sorted, time);
+  }
+
+  // Exit with an error, so that scripts and CI catch incorrect primitives
+  if (failures > 0) {
+    throw std::runtime_error(std::format(
+        "{} parallel primitive checks failed with seed {}", failures, MSeed));
+  }
+}
@@ -0,0 +1,133 @@
+// Copyright (c) 2025-2026 Ewan Crawford
+
+#include "common.hpp"
+#include <algorithm>
+#include <chrono>
+#include <format>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+// Radius around the cursor queried on click, and nearest particles found
+constexpr float CursorQueryRadius = 0.05f;
+constexpr uint32_t CursorNearestCount = 8;
+} // anonymous namespace
+
+std::future<std::vector<SpatialQueryResult>>
+vkParticle::submitSpatialQueries(std::vector<SpatialQuery> queries) {
+  if (!MOptions.spatialQueries) {
+    throw std::runtime_error("spatial queries require '--queries'");
+  }
+  if (queries.size() > SMaxSpatialQueries) {
+    throw std::runtime_error(std::format(
+        "at most {} spatial queries can be submitted in a batch",
+        SMaxSpatialQueries));
+  }
+
+  SpatialQueryBatch batch{.queries = std::move(queries)};
+  auto results = batch.promise.get_future();
+  std::lock_guard lock(MSpatialQueryMutex);
+  MPendingSpatialQueries.push_back(std::move(batch));
+  return results;
+}
+
+void vkParticle::recordSpatialQueryCommands(
+    vk::raii::CommandBuffer &commandBuffer, uint32_t inState,
+    uint32_t outState, uint32_t particleCount) {
+  // Take whole batches in order of submission until the step is full, the
+  // rest wait for a later step.
+  uint32_t queryCount = 0;
+  {
+    std::lock_guard lock(MSpatialQueryMutex);
+    while (!MPendingSpatialQueries.empty() &&
+           queryCount + MPendingSpatialQueries.front().queries.size() <=
+               SMaxSpatialQueries) {
+      queryCount += static_cast<uint32_t>(
+          MPendingSpatialQueries.front().queries.size());
+      MRecordedSpatialQueries.push_back(
+          std::move(MPendingSpatialQueries.front()));
+      MPendingSpatialQueries.pop_front();
+    }
+  }
+  if (queryCount == 0) {
+    return;
+  }
+
+  // The last step has completed, so the buffer is no longer being read
+  SpatialQuery *queries = MSpatialQueryMapped;
+  for (const SpatialQueryBatch &batch : MRecordedSpatialQueries) {
+    queries = std::ranges::copy(batch.queries, queries).out;
+  }
+
+  // Grid of the state being read, as the step itself may not build one.
+  // The collide kernel rebuilds it again for the step, only on steps with
+  // queries.
+  recordGridRebuildCommands(commandBuffer, inState, outState, particleCount);
+  ComputePushConstants pushConstants{.queryCount = queryCount};
+  commandBuffer.pushConstants<ComputePushConstants>(
+      MComputePipelineLayout, vk::ShaderStageFlagBits::eCompute, 0,
+      pushConstants);
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             MSpatialQueryPipeline);
+  commandBuffer.dispatch(
+      (queryCount + SComputeWorkItems - 1) / SComputeWorkItems, 1, 1);
+
+  // Make the results visible to the host once the step has completed, and
+  // keep the step from overwriting the grid while it is being searched.
+  memoryBarrier(commandBuffer, vk::PipelineStageFlagBits2::eComputeShader,
+                vk::AccessFlagBits2::eShaderStorageRead |
+                    vk::AccessFlagBits2::eShaderStorageWrite,
+                vk::PipelineStageFlagBits2::eComputeShader |
+                    vk::PipelineStageFlagBits2::eTransfer |
+                    vk::PipelineStageFlagBits2::eHost,
+                vk::AccessFlagBits2::eShaderStorageWrite |
+                    vk::AccessFlagBits2::eTransferWrite |
+                    vk::AccessFlagBits2::eHostRead);
+}
+
+void vkParticle::completeSpatialQueries() {
+  const uint32_t *result = MSpatialResultMapped;
+  for (SpatialQueryBatch &batch : MRecordedSpatialQueries) {
+    std::vector<SpatialQueryResult> results;
+    results.reserve(batch.queries.size());
+    for (size_t query = 0; query < batch.queries.size(); query++) {
+      uint32_t matched = result[0];
+      uint32_t returned = std::min(matched, SSpatialQueryCapacity);
+      results.push_back({.particles = std::vector(result + 1,
+                                                  result + 1 + returned),
+                         .matched = matched});
+      result += SSpatialQueryCapacity + 1;
+    }
+    batch.promise.set_value(std::move(results));
+  }
+  MRecordedSpatialQueries.clear();
+}
+
+void vkParticle::updateCursorQuery() {
+  // Only a single cursor query is in flight at a time
+  if (MCursorClick && !MCursorQuery.valid()) {
+    std::vector<SpatialQuery> queries{
+        {.type = SpatialQueryType::Radius,
+         .point = *MCursorClick,
+         .extent = {CursorQueryRadius, 0.0f}},
+        {.type = SpatialQueryType::Nearest,
+         .count = CursorNearestCount,
+         .point = *MCursorClick}};
+    MCursorQuery = submitSpatialQueries(std::move(queries));
+    MCursorClick.reset();
+  }
+
+  using namespace std::chrono_literals;
+  if (!MCursorQuery.valid() ||
+      MCursorQuery.wait_for(0s) != std::future_status::ready) {
+    return;
+  }
+  std::vector<SpatialQueryResult> results = MCursorQuery.get();
+  std::string nearest;
+  for (uint32_t particle : results[1].particles) {
+    nearest += std::format(" {}", particle);
+  }
+  std::cout << std::format("{} particles within {} of cursor, nearest:{}",
+                           results[0].matched, CursorQueryRadius, nearest)
+            << std::endl;
+}
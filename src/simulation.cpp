@@ -0,0 +1,229 @@
+// Copyright (c) 2025-2026 Ewan Crawford
+
+#include "common.hpp"
+#include <bit>
+#include <format>
+#include <iostream>
+
+void vkParticle::simulationLoop(std::stop_token stopToken) {
+  try {
+    // The simulation reads from the state it last wrote, and writes to a
+    // state that neither it or the renderer hold. Matches the initial mailbox
+    // contents set in vkParticle::createSyncObjects().
+    uint32_t inState = 0;
+    uint32_t outState = SSimulationStateCount - 1;
+    double lastTime = glfwGetTime();
+
+    // Starts at the minimum particle count, growing while the measured GPU
+    // time leaves headroom within the frame time target.
+    ParticleBudget budget(SMinParticleCount, SMaxParticleCount,
+                          SComputeWorkItems, SFrameTimeTarget);
+
+    // Accumulated between reports when printing statistics
+    uint32_t statsSteps = 0;
+    double statsComputeTime = 0.0;
+    double lastStatsTime = lastTime;
+
+    while (!stopToken.stop_requested()) {
+      // We want to animate the particle system using the last steps time to
+      // get smooth, step-rate independent animation
+      double currentTime = glfwGetTime();
+      float deltaTime = MOptions.seed
+                            ? SSeededDeltaTime
+                            : static_cast<float>((currentTime - lastTime) *
+                                                 1000.0);
+      lastTime = currentTime;
+
+      // Seeded runs simulate every particle, as the budget depends on the
+      // measured GPU time.
+      uint32_t particleCount =
+          MOptions.seed ? SMaxParticleCount : budget.count();
+      uint64_t computeValue = submitSimulationStep(inState, outState,
+                                                   deltaTime * 2.f,
+                                                   particleCount);
+      MSimulationStates[outState].particleCount = particleCount;
+
+      // Only completed states are published, so that the renderer never has
+      // to wait on an in-progress step.
+      vk::SemaphoreWaitInfo waitInfo{.semaphoreCount = 1,
+                                     .pSemaphores = &*MComputeSemaphore,
+                                     .pValues = &computeValue};
+      while (vk::Result::eTimeout ==
+             MDevice.waitSemaphores(waitInfo, UINT64_MAX))
+        ;
+
+      if (MOptions.spatialQueries) {
+        completeSpatialQueries();
+      }
+      if (MOptions.injection) {
+        releaseSpawnRecords();
+      }
+      if (MAnalyticsRecorded) {
+        writeAnalytics(currentTime, particleCount);
+      }
+
+      double computeTime = 0.0;
+      if (MTimestampPeriod > 0.0f) {
+        computeTime = readTimestampQueries(MComputeQueryPool, outState * 2);
+        budget.update(computeTime,
+                      MRenderTime.load(std::memory_order_relaxed));
+      }
+
+      if (MOptions.stats) {
+        statsSteps++;
+        statsComputeTime += computeTime;
+        if (MGridBuild != GridBuild::None && MTimestampPeriod > 0.0f) {
+          double gridTime = readTimestampQueries(MGridQueryPool, outState * 2);
+          if (MGridBuild == GridBuild::Incremental) {
+            MGridStats.incrementalBuilds++;
+            MGridStats.incrementalTime += gridTime;
+          } else {
+            MGridStats.fullBuilds++;
+            MGridStats.fullTime += gridTime;
+          }
+        }
+        if (usesStageTimes() && MTimestampPeriod > 0.0f) {
+          const uint32_t firstQuery =
+              outState * static_cast<uint32_t>(MStageTimes.size() + 1);
+          for (size_t stage = 0; stage < MStageTimes.size(); stage++) {
+            MStageTimes[stage] += readTimestampQueries(
+                MStageQueryPool, firstQuery + static_cast<uint32_t>(stage));
+          }
+        }
+        if (MGridCompared) {
+          MGridStats.churned += *MGridChurnMapped;
+          MGridStats.compared += particleCount;
+        }
+        if (currentTime - lastStatsTime >= 1.0) {
+          printSimulationStats(statsSteps, currentTime - lastStatsTime,
+                               statsComputeTime, particleCount);
+          statsSteps = 0;
+          statsComputeTime = 0.0;
+          lastStatsTime = currentTime;
+        }
+      }
+
+      // Publish the state to the renderer, taking back whichever state was
+      // previously in the mailbox to write the next step into. The exchange
+      // also makes the `SimulationState` of the returned state, as written by
+      // the renderer, visible to this thread.
+      uint64_t previous = MLatestState.exchange(
+          (computeValue << SStateValueShift) | SFreshStateBit | outState,
+          std::memory_order_acq_rel);
+      inState = outState;
+      outState = static_cast<uint32_t>(previous & SStateIndexMask);
+    }
+  } catch (...) {
+    MSimulationError = std::current_exception();
+    MSimulationFailed = true;
+  }
+}
+
+uint64_t vkParticle::submitSimulationStep(uint32_t inState, uint32_t outState,
+                                          float deltaTime,
+                                          uint32_t particleCount) {
+  // Commit memory for any particles added by the budget
+  ensureStorageCapacity(particleCount);
+  if (MOptions.injection) {
+    acquireSpawnRecords(particleCount);
+  }
+
+  // Update uniform buffer with delta time
+  updateUniformBuffer(outState, deltaTime, particleCount);
+
+  // Setup compute command-buffer with commands.
+  recordComputeCommandBuffer(inState, outState, particleCount);
+
+  // The step that wrote `inState` has completed, but the last draw that read
+  // from `outState` before the renderer handed it back may not have.
+  uint64_t waitValue = MSimulationStates[outState].graphicsValue;
+  uint64_t signalValue = ++MComputeTimelineValue;
+
+  // Set timeline semaphore values
+  vk::TimelineSemaphoreSubmitInfo computeTimelineInfo{
+      .waitSemaphoreValueCount = 1,
+      .pWaitSemaphoreValues = &waitValue,
+      .signalSemaphoreValueCount = 1,
+      .pSignalSemaphoreValues = &signalValue};
+
+  // Which stage of the pipeline to wait on for semaphores
+  vk::PipelineStageFlags waitStages[] = {
+      vk::PipelineStageFlagBits::eComputeShader};
+  // Submit command-buffer to queue
+  vk::SubmitInfo computeSubmitInfo{
+      .pNext = &computeTimelineInfo,
+      .waitSemaphoreCount = 1,
+      .pWaitSemaphores = &*MGraphicsSemaphore,
+      .pWaitDstStageMask = waitStages,
+      .commandBufferCount = 1,
+      .pCommandBuffers = &*MComputeCommandBuffers[outState],
+      .signalSemaphoreCount = 1,
+      .pSignalSemaphores = &*MComputeSemaphore};
+
+  // Only need to serialize with the render thread if there is a single queue
+  auto lock = lockSharedQueue();
+  MComputeQueue.submit(computeSubmitInfo, nullptr);
+  return signalValue;
+}
+
+void vkParticle::printSimulationStats(uint32_t steps, double elapsed,
+                                      double computeTime,
+                                      uint32_t particleCount) {
+  std::string stats = std::format(
+      "particles {} steps/s {:.1f} compute {:.4f} ms/step render {:.4f} ms",
+      particleCount, steps / elapsed, computeTime / steps,
+      MRenderTime.load(std::memory_order_relaxed));
+  // Error of the last step against the fp32 reference, which the step has
+  // completed writing.
+  if (MPrecisionErrorMapped) {
+    stats += std::format(" fp16 max error {:.6f}",
+                         std::bit_cast<float>(*MPrecisionErrorMapped));
+  }
+  // Neighbour lists were last built by a step which has completed
+  if (MNeighbourTotalMapped && MNeighbourListCount > 0) {
+    stats += std::format(
+        " list rebuilds {:.1f}% avg neighbours {:.1f} max {}",
+        100.0 * MNeighbourRebuilds / steps,
+        static_cast<double>(*MNeighbourTotalMapped) / MNeighbourListCount,
+        *MNeighbourMaxCountMapped);
+    // Particles with more neighbours than their list holds use the grid
+    if (*MNeighbourMaxCountMapped > SNeighbourCapacity) {
+      stats += " (lists overflowed)";
+    }
+    MNeighbourRebuilds = 0;
+  }
+  // Average grid build times, to compare incremental builds against full
+  // builds at the churn of the simulation.
+  if (MGridStats.compared > 0) {
+    const GridStats &grid = MGridStats;
+    double fullTime = grid.fullBuilds ? grid.fullTime / grid.fullBuilds : 0.0;
+    double incrementalTime =
+        grid.incrementalBuilds ? grid.incrementalTime / grid.incrementalBuilds
+                               : 0.0;
+    stats += std::format(
+        " churn {:.2f}% grid full {:.4f} ms incremental {:.4f} ms",
+        100.0 * grid.churned / grid.compared, fullTime, incrementalTime);
+    if (fullTime > 0.0 && incrementalTime > 0.0) {
+      stats += std::format(" speedup {:.2f}x", fullTime / incrementalTime);
+    }
+  }
+  MGridStats = {};
+  // Capacity bound so far, which grows with the particle count
+  if (MSparseStorage) {
+    stats += std::format(" committed {} particles", MCommittedParticles);
+  }
+  // Average time of each plasma or fluid stage
+  if (usesStageTimes() && MTimestampPeriod > 0.0f) {
+    constexpr std::array<const char *, 4> PlasmaStages{"deposit", "solve",
+                                                       "field", "push"};
+    constexpr std::array<const char *, 4> FluidStages{"transfer", "solve",
+                                                      "project", "gather"};
+    const auto &names = usesPlasma() ? PlasmaStages : FluidStages;
+    for (size_t stage = 0; stage < MStageTimes.size(); stage++) {
+      stats += std::format(" {} {:.4f} ms", names[stage],
+                           MStageTimes[stage] / steps);
+    }
+    MStageTimes = {};
+  }
+  std::cout << stats << std::endl;
+}
@@ -0,0 +1,211 @@
+// Copyright (c) 2025-2026 Ewan Crawford
+
+#include "common.hpp"
+
+void vkParticle::createSurfaceRenderer() {
+  // The surface shaders use the descriptor bindings of set 1, sharing the
+  // particle binding with the compute renderer:
+  // 0. `StructuredBuffer<ParticleSSBO>` state being drawn
+  // 2. `RWStructuredBuffer<uint>` splatted thickness
+  // 3. `RWStructuredBuffer<float>` filtered thickness
+  // 4. `StructuredBuffer<float>` smoothed thickness shaded by the fragment
+  //    shader, a read only view of the second half of binding 3.
+  std::array layoutBindings{
+      vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eStorageBuffer, 1,
+                                     vk::ShaderStageFlagBits::eCompute,
+                                     nullptr),
+      vk::DescriptorSetLayoutBinding(2, vk::DescriptorType::eStorageBuffer, 1,
+                                     vk::ShaderStageFlagBits::eCompute,
+                                     nullptr),
+      vk::DescriptorSetLayoutBinding(3, vk::DescriptorType::eStorageBuffer, 1,
+                                     vk::ShaderStageFlagBits::eCompute,
+                                     nullptr),
+      vk::DescriptorSetLayoutBinding(4, vk::DescriptorType::eStorageBuffer, 1,
+                                     vk::ShaderStageFlagBits::eFragment,
+                                     nullptr)};
+  vk::DescriptorSetLayoutCreateInfo layoutInfo{
+      .bindingCount = static_cast<uint32_t>(layoutBindings.size()),
+      .pBindings = layoutBindings.data()};
+  MSurfaceDescriptorSetLayout =
+      vk::raii::DescriptorSetLayout(MDevice, layoutInfo);
+
+  // Like the compute renderer, set 0 is never used but keeps the surface
+  // bindings at the same set index as they are in the shader source.
+  std::array setLayouts{*MComputeDescriptorSetLayout,
+                        *MSurfaceDescriptorSetLayout};
+  vk::PushConstantRange pushConstantRange{
+      .stageFlags = vk::ShaderStageFlagBits::eCompute,
+      .offset = 0,
+      .size = sizeof(ComputePushConstants)};
+  vk::PipelineLayoutCreateInfo pipelineLayoutInfo{
+      .setLayoutCount = static_cast<uint32_t>(setLayouts.size()),
+      .pSetLayouts = setLayouts.data(),
+      .pushConstantRangeCount = 1,
+      .pPushConstantRanges = &pushConstantRange};
+  MSurfacePipelineLayout =
+      vk::raii::PipelineLayout(MDevice, pipelineLayoutInfo);
+
+  vk::raii::ShaderModule shaderModule =
+      createShaderModule(readFile("slang.spv"), MDevice);
+  MSurfaceSplatPipeline = createComputeKernel(shaderModule, "compSurfaceSplat",
+                                              &MSurfacePipelineLayout);
+  MSurfaceFilterPipeline = createComputeKernel(
+      shaderModule, "compSurfaceFilter", &MSurfacePipelineLayout);
+
+  // Shading draws a single full screen triangle, generated from the vertex
+  // index, so there is no vertex input and nothing to blend.
+  std::array shaderStages{
+      vk::PipelineShaderStageCreateInfo{.stage =
+                                            vk::ShaderStageFlagBits::eVertex,
+                                        .module = shaderModule,
+                                        .pName = "vertSurface"},
+      vk::PipelineShaderStageCreateInfo{.stage =
+                                            vk::ShaderStageFlagBits::eFragment,
+                                        .module = shaderModule,
+                                        .pName = "fragSurface"}};
+  vk::PipelineVertexInputStateCreateInfo vertexInputInfo{};
+  vk::PipelineInputAssemblyStateCreateInfo inputAssembly{
+      .topology = vk::PrimitiveTopology::eTriangleList};
+  vk::PipelineViewportStateCreateInfo viewportState{.viewportCount = 1,
+                                                    .scissorCount = 1};
+  std::array dynamicStates{vk::DynamicState::eViewport,
+                           vk::DynamicState::eScissor};
+  vk::PipelineDynamicStateCreateInfo dynamicState{
+      .dynamicStateCount = static_cast<uint32_t>(dynamicStates.size()),
+      .pDynamicStates = dynamicStates.data()};
+  vk::PipelineRasterizationStateCreateInfo rasterizer{
+      .polygonMode = vk::PolygonMode::eFill,
+      .cullMode = vk::CullModeFlagBits::eNone,
+      .lineWidth = 1.0f};
+  vk::PipelineMultisampleStateCreateInfo multisampling{
+      .rasterizationSamples = vk::SampleCountFlagBits::e1};
+  vk::PipelineColorBlendAttachmentState colorBlendAttachment{
+      .blendEnable = vk::False,
+      .colorWriteMask =
+          vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG |
+          vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA};
+  vk::PipelineColorBlendStateCreateInfo colorBlending{
+      .attachmentCount = 1, .pAttachments = &colorBlendAttachment};
+  vk::PipelineRenderingCreateInfo pipelineRenderingCreateInfo{
+      .colorAttachmentCount = 1,
+      .pColorAttachmentFormats = &MSwapChainSurfaceFormat.format};
+  vk::GraphicsPipelineCreateInfo pipelineInfo{
+      .pNext = &pipelineRenderingCreateInfo,
+      .stageCount = static_cast<uint32_t>(shaderStages.size()),
+      .pStages = shaderStages.data(),
+      .pVertexInputState = &vertexInputInfo,
+      .pInputAssemblyState = &inputAssembly,
+      .pViewportState = &viewportState,
+      .pRasterizationState = &rasterizer,
+      .pMultisampleState = &multisampling,
+      .pColorBlendState = &colorBlending,
+      .pDynamicState = &dynamicState,
+      .layout = *MSurfacePipelineLayout,
+      .renderPass = nullptr};
+  MSurfaceShadePipeline = vk::raii::Pipeline(MDevice, nullptr, pipelineInfo);
+
+  // Only touched by the GPU, other than the fill clearing the thickness each
+  // frame. Shared by the frames in flight, which the graphics queue runs in
+  // order.
+  createBuffer(MDevice, MPhysicalDevice, sizeof(uint32_t) * SSurfacePixels,
+               vk::BufferUsageFlagBits::eStorageBuffer |
+                   vk::BufferUsageFlagBits::eTransferDst,
+               vk::MemoryPropertyFlagBits::eDeviceLocal,
+               MSurfaceThicknessBuffer, MSurfaceThicknessBufferMemory);
+  constexpr vk::DeviceSize PassSize = sizeof(float) * SSurfacePixels;
+  createBuffer(MDevice, MPhysicalDevice, 2 * PassSize,
+               vk::BufferUsageFlagBits::eStorageBuffer,
+               vk::MemoryPropertyFlagBits::eDeviceLocal,
+               MSurfaceFilteredBuffer, MSurfaceFilteredBufferMemory);
+
+  // A set for each state that may be drawn
+  vk::DescriptorPoolSize poolSize(vk::DescriptorType::eStorageBuffer,
+                                  SSimulationStateCount *
+                                      static_cast<uint32_t>(
+                                          layoutBindings.size()));
+  vk::DescriptorPoolCreateInfo poolInfo{
+      .flags = vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet,
+      .maxSets = SSimulationStateCount,
+      .poolSizeCount = 1,
+      .pPoolSizes = &poolSize};
+  MSurfaceDescriptorPool = vk::raii::DescriptorPool(MDevice, poolInfo);
+  std::vector<vk::DescriptorSetLayout> layouts(SSimulationStateCount,
+                                               *MSurfaceDescriptorSetLayout);
+  vk::DescriptorSetAllocateInfo allocInfo{
+      .descriptorPool = *MSurfaceDescriptorPool,
+      .descriptorSetCount = SSimulationStateCount,
+      .pSetLayouts = layouts.data()};
+  MSurfaceDescriptorSets = MDevice.allocateDescriptorSets(allocInfo);
+
+  for (uint32_t state = 0; state < SSimulationStateCount; state++) {
+    std::array bufferInfos{
+        vk::DescriptorBufferInfo(MShaderStorageBuffers[state], 0,
+                                 sizeof(Particle) * SMaxParticleCount),
+        vk::DescriptorBufferInfo(MSurfaceThicknessBuffer, 0, vk::WholeSize),
+        vk::DescriptorBufferInfo(MSurfaceFilteredBuffer, 0, vk::WholeSize),
+        vk::DescriptorBufferInfo(MSurfaceFilteredBuffer, PassSize,
+                                 PassSize)};
+    std::vector<vk::WriteDescriptorSet> descriptorWrites;
+    for (size_t i = 0; i < bufferInfos.size(); i++) {
+      descriptorWrites.push_back(
+          {.dstSet = *MSurfaceDescriptorSets[state],
+           .dstBinding = layoutBindings[i].binding,
+           .dstArrayElement = 0,
+           .descriptorCount = 1,
+           .descriptorType = vk::DescriptorType::eStorageBuffer,
+           .pBufferInfo = &bufferInfos[i]});
+    }
+    MDevice.updateDescriptorSets(descriptorWrites, {});
+  }
+}
+
+void vkParticle::recordSurfaceCommands() {
+  vk::raii::CommandBuffer &commandBuffer =
+      MGraphicsCommandBuffers[MCurrentFrame];
+
+  // The last frame may still be shading from the filtered thickness
+  memoryBarrier(commandBuffer, vk::PipelineStageFlagBits2::eFragmentShader,
+                {},
+                vk::PipelineStageFlagBits2::eComputeShader |
+                    vk::PipelineStageFlagBits2::eTransfer,
+                {});
+  commandBuffer.fillBuffer(MSurfaceThicknessBuffer, 0, vk::WholeSize, 0);
+  memoryBarrier(commandBuffer, vk::PipelineStageFlagBits2::eTransfer,
+                vk::AccessFlagBits2::eTransferWrite,
+                vk::PipelineStageFlagBits2::eComputeShader,
+                vk::AccessFlagBits2::eShaderStorageRead |
+                    vk::AccessFlagBits2::eShaderStorageWrite);
+
+  commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute,
+                                   MSurfacePipelineLayout, 1,
+                                   {MSurfaceDescriptorSets[MRenderState]}, {});
+  uint32_t particleCount = MSimulationStates[MRenderState].particleCount;
+  ComputePushConstants pushConstants{.particleCount = particleCount};
+  commandBuffer.pushConstants<ComputePushConstants>(
+      MSurfacePipelineLayout, vk::ShaderStageFlagBits::eCompute, 0,
+      pushConstants);
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             MSurfaceSplatPipeline);
+  commandBuffer.dispatch(
+      (particleCount + SComputeWorkItems - 1) / SComputeWorkItems, 1, 1);
+
+  // Horizontal then vertical pass of the filter, with 16x16 work-groups
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             MSurfaceFilterPipeline);
+  for (uint32_t pass = 0; pass < 2; pass++) {
+    memoryBarrier(commandBuffer, vk::PipelineStageFlagBits2::eComputeShader,
+                  vk::AccessFlagBits2::eShaderStorageWrite,
+                  vk::PipelineStageFlagBits2::eComputeShader,
+                  vk::AccessFlagBits2::eShaderStorageRead);
+    pushConstants.sweep = pass;
+    commandBuffer.pushConstants<ComputePushConstants>(
+        MSurfacePipelineLayout, vk::ShaderStageFlagBits::eCompute, 0,
+        pushConstants);
+    commandBuffer.dispatch((SSurfaceWidth + 15) / 16,
+                           (SSurfaceHeight + 15) / 16, 1);
+  }
+  memoryBarrier(commandBuffer, vk::PipelineStageFlagBits2::eComputeShader,
+                vk::AccessFlagBits2::eShaderStorageWrite,
+                vk::PipelineStageFlagBits2::eFragmentShader,
+                vk::AccessFlagBits2::eShaderStorageRead);
+}
@@ -38,6 +38,27 @@ vk::SurfaceFormatKHR chooseSwapSurfaceFormat(
   return formatIt != availableFormats.end() ? *formatIt : availableFormats[0];
 }
 
+std::optional<vk::SurfaceFormatKHR> chooseStorageSurfaceFormat(
+    const vk::raii::PhysicalDevice &physicalDevice,
+    std::vector<vk::SurfaceFormatKHR> const &availableFormats) {
+  // SRGB formats can't be used as storage images, so pick a UNORM format
+  // that can be, and have the compute renderer encode colors itself.
+  for (vk::Format candidate :
+       {vk::Format::eB8G8R8A8Unorm, vk::Format::eR8G8B8A8Unorm}) {
+    const auto formatIt =
+        std::ranges::find_if(availableFormats, [&](const auto &format) {
+          return format.format == candidate &&
+                 format.colorSpace == vk::ColorSpaceKHR::eSrgbNonlinear;
+        });
+    if (formatIt != availableFormats.end() &&
+        (physicalDevice.getFormatProperties(candidate).optimalTilingFeatures &
+         vk::FormatFeatureFlagBits::eStorageImage)) {
+      return *formatIt;
+    }
+  }
+  return std::nullopt;
+}
+
 vk::PresentModeKHR chooseSwapPresentMode(
     const std::vector<vk::PresentModeKHR> &availablePresentModes) {
   // FIFO is a standard first-in-first-out queue, if the queue is full then
@@ -78,8 +99,31 @@ void vkParticle::createSwapChain() {
   auto surfaceCapabilities =
       MPhysicalDevice.getSurfaceCapabilitiesKHR(*MSurface);
   MSwapChainExtent = chooseSwapExtent(MWindow, surfaceCapabilities);
-  MSwapChainSurfaceFormat =
-      chooseSwapSurfaceFormat(MPhysicalDevice.getSurfaceFormatsKHR(*MSurface));
+  auto availableFormats = MPhysicalDevice.getSurfaceFormatsKHR(*MSurface);
+
+  // The compute renderer writes particles straight into the swapchain image,
+  // falling back to the graphics pipeline if the surface can't be written to
+  // as a storage image. Only chosen for the first swapchain, as the splat and
+  // graphics pipelines aren't rebuilt when it is recreated.
+  if (!MSwapChainFormatChosen) {
+    std::optional<vk::SurfaceFormatKHR> storageFormat;
+    if (MOptions.renderer == Renderer::Compute &&
+        MSupportsStorageWriteWithoutFormat &&
+        (surfaceCapabilities.supportedUsageFlags &
+         vk::ImageUsageFlagBits::eStorage)) {
+      storageFormat = chooseStorageSurfaceFormat(MPhysicalDevice,
+                                                 availableFormats);
+    }
+    MComputePresent = storageFormat.has_value();
+    MSwapChainSurfaceFormat = MComputePresent
+                                  ? *storageFormat
+                                  : chooseSwapSurfaceFormat(availableFormats);
+    MSwapChainFormatChosen = true;
+  }
+  vk::ImageUsageFlags imageUsage = vk::ImageUsageFlagBits::eColorAttachment;
+  if (MComputePresent) {
+    imageUsage |= vk::ImageUsageFlagBits::eStorage;
+  }
   vk::SwapchainCreateInfoKHR swapChainCreateInfo{
       .surface = *MSurface,
       .minImageCount = chooseSwapMinImageCount(surfaceCapabilities),
@@ -87,7 +131,7 @@ void vkParticle::createSwapChain() {
       .imageColorSpace = MSwapChainSurfaceFormat.colorSpace,
       .imageExtent = MSwapChainExtent,
       .imageArrayLayers = 1,
-      .imageUsage = vk::ImageUsageFlagBits::eColorAttachment,
+      .imageUsage = imageUsage,
       // Exclusive means that image is owned by 1 queue family at a time
       .imageSharingMode = vk::SharingMode::eExclusive,
       .preTransform = surfaceCapabilities.currentTransform,
@@ -114,6 +158,8 @@ void vkParticle::createImageViews() {
 }
 
 void vkParticle::cleanupSwapChain() {
+  MSplatDescriptorSets.clear();
+  MSplatDescriptorPool = nullptr;
   MSwapChainImageViews.clear();
   MSwapChain = nullptr;
 }
@@ -126,9 +172,18 @@ void vkParticle::recreateSwapChain() {
     glfwWaitEvents();
   }
 
-  MDevice.waitIdle();
+  // The simulation thread keeps submitting to the compute queue, so only wait
+  // for the graphics queue to drain rather than the whole device.
+  {
+    auto lock = lockSharedQueue();
+    MQueue.waitIdle();
+  }
 
   cleanupSwapChain();
   createSwapChain();
   createImageViews();
+  // Splat descriptor sets reference the swapchain images
+  if (MComputePresent) {
+    createSplatDescriptorSets();
+  }
 }